@@ -0,0 +1,167 @@
+// Tick workload on both reactor backends
+// Every tick each client sends a CLIENT_UPDATE sized message, the reactor reads all of them
+// and answers every client with a SERVER_UPDATE sized one, as the server loop does
+// Reports time and reactor syscalls (epoll_wait()/epoll_ctl() or io_uring_enter()) per tick,
+// reads and writes are a syscall each on both backends and are not counted
+//
+// Usage: ./backends [connections] [ticks]
+
+#include "utils/log.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
+#include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
+#include "net/uring.c"
+#include "net/timer.c"
+#include "net/reactor.c"
+
+#include <stdio.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Wire sizes of CLIENT_UPDATE and SERVER_UPDATE
+#define REQUEST_SIZE 12
+#define RESPONSE_SIZE 28
+
+typedef struct {
+  TcpStream stream;
+  // Client end of the connection, driven with plain syscalls
+  int client;
+  int* received;
+} Connection;
+
+static int connection_event(void* context, unsigned events) {
+  Connection* connection = context;
+  if (!(events & IO_EVENT_READ)) {
+    return 0;
+  }
+
+  if (tcp_recv(&connection->stream) != 1) {
+    return -1;
+  }
+
+  int n = tcp_received(&connection->stream);
+  *connection->received += n / REQUEST_SIZE;
+  return tcp_consume(&connection->stream, n - n % REQUEST_SIZE);
+}
+
+// Connect |n| clients to a loopback listener
+static int connect_clients(Reactor* reactor, Connection* connections, int n, int* received) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t size = sizeof(address);
+  if (listener == -1 || bind(listener, (struct sockaddr*)&address, size) == -1 || listen(listener, n) == -1 ||
+      getsockname(listener, (struct sockaddr*)&address, &size) == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    Connection* connection = &connections[i];
+    connection->client = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection->client == -1 || connect(connection->client, (struct sockaddr*)&address, size) == -1) {
+      return -1;
+    }
+
+    int server = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+    int flag = 1;
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(connection->client, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    if (server == -1 || tcp_from_socket(&connection->stream, reactor, server) == -1) {
+      return -1;
+    }
+
+    connection->received = received;
+    evented_set_handler(&connection->stream.state, connection_event, connection);
+    if (tcp_start_recv(&connection->stream) == -1 || tcp_set_eager_send(&connection->stream) == -1) {
+      return -1;
+    }
+  }
+
+  close(listener);
+  return 0;
+}
+
+static int run(ReactorBackend backend, const char* name, int n, int ticks) {
+  Reactor reactor;
+  if (reactor_init_backend(&reactor, backend) == -1) {
+    printf("%-9s unavailable: %s\n", name, strerror(errno));
+    return 0;
+  }
+
+  Connection* connections = calloc(n, sizeof(Connection));
+  int received = 0;
+  if (connections == NULL || connect_clients(&reactor, connections, n, &received) == -1) {
+    perror("connect");
+    return -1;
+  }
+
+  char request[REQUEST_SIZE] = {0};
+  char response[RESPONSE_SIZE] = {0};
+  uint64_t loop_ns = 0;
+  uint64_t iterations = 0;
+  uint64_t syscalls = reactor_syscalls(&reactor);
+  for (int tick = 0; tick < ticks; ++tick) {
+    for (int i = 0; i < n; ++i) {
+      if (write(connections[i].client, request, sizeof(request)) != sizeof(request)) {
+        perror("write");
+        return -1;
+      }
+    }
+
+    // input stage: dispatch till every update is read, then answer like the tick does
+    uint64_t start = clock_now_ns();
+    received = 0;
+    while (received < n) {
+      if (reactor_dispatch(&reactor, -1) == -1) {
+        perror("dispatch");
+        return -1;
+      }
+      iterations++;
+    }
+
+    for (int i = 0; i < n; ++i) {
+      if (tcp_start_send(&connections[i].stream, response, sizeof(response)) != sizeof(response)) {
+        perror("send");
+        return -1;
+      }
+    }
+    loop_ns += clock_now_ns() - start;
+
+    for (int i = 0; i < n; ++i) {
+      if (read(connections[i].client, response, sizeof(response)) != sizeof(response)) {
+        perror("read");
+        return -1;
+      }
+    }
+  }
+
+  syscalls = reactor_syscalls(&reactor) - syscalls;
+  printf("%-9s %6d connections: %8.1f us/tick, %6.1f ns/event, %5.2f loop iterations/tick, "
+         "%5.2f reactor syscalls/iteration\n",
+         name, n, loop_ns / 1000.0 / ticks, (double)loop_ns / ((uint64_t)ticks * n),
+         (double)iterations / ticks, (double)syscalls / iterations);
+
+  for (int i = 0; i < n; ++i) {
+    tcp_close(&connections[i].stream);
+    close(connections[i].client);
+  }
+  free(connections);
+  reactor_close(&reactor);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 256;
+  int ticks = argc > 2 ? atoi(argv[2]) : 1000;
+  if (n <= 0 || ticks <= 0) {
+    fprintf(stderr, "Usage: %s [connections] [ticks]\n", argv[0]);
+    return 1;
+  }
+
+  if (run(REACTOR_BACKEND_EPOLL, "epoll", n, ticks) == -1 || run(REACTOR_BACKEND_IO_URING, "io_uring", n, ticks) == -1) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,20 @@
+#! /usr/bin/bash
+
+# Every benchmark is a single compilation unit, built with the flags of the server
+for source in *.c; do
+  clang -o "${source%.c}" "$source"           \
+        -std=c11                              \
+        -O2 -flto                             \
+        -fuse-ld=lld                          \
+        -fvisibility=hidden                   \
+        -pthread                              \
+        -Werror=implicit-function-declaration \
+        -Werror=implicit-int                  \
+        -Werror=int-conversion                \
+        -Werror=return-type                   \
+        -Werror=unused-variable               \
+        -Werror=unused-parameter              \
+        -I..                                  \
+        -I../utils                            \
+        -D_GNU_SOURCE || exit 1
+done
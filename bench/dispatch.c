@@ -0,0 +1,144 @@
+// Cost of reactor_dispatch() per event at 64 events per wake
+// Deferred events of virtual objects show the dispatch overhead alone (plus a non-blocking poll per wake),
+// eventfds show it together with the backend and a read() per event, the handlers only count calls
+//
+// Usage: ./dispatch [wakes]
+
+#include "utils/log.c"
+#include "net/uring.c"
+#include "net/timer.c"
+#include "net/reactor.c"
+
+#include <stdio.h>
+
+#define EVENTS_PER_WAKE 64
+
+typedef struct {
+  Evented state;
+  uint64_t calls;
+} Object;
+
+static int object_event(void* context, unsigned events) {
+  (void)events;
+  Object* object = context;
+  object->calls++;
+  return 0;
+}
+
+// Handlers also clear the eventfd, so it reports an edge on the next write
+static int eventfd_event(void* context, unsigned events) {
+  (void)events;
+  Object* object = context;
+  uint64_t value = 0;
+  object->calls++;
+  return read(object->state.fd, &value, sizeof(value)) == sizeof(value) ? 0 : -1;
+}
+
+static void report(const char* name, uint64_t ns, int wakes) {
+  printf("%-30s %7.1f ns/event, %8.1f ns/wake\n", name,
+         (double)ns / ((uint64_t)wakes * EVENTS_PER_WAKE), (double)ns / wakes);
+}
+
+// Defer an event of every object and dispatch them, which takes a single wake
+static int run_deferred(ReactorBackend backend, const char* name, bool stats, int wakes) {
+  Reactor reactor;
+  if (reactor_init_backend(&reactor, backend) == -1) {
+    printf("%-30s unavailable: %s\n", name, strerror(errno));
+    return 0;
+  }
+
+  Object objects[EVENTS_PER_WAKE];
+  Histogram handler_ns = {0};
+  for (int i = 0; i < EVENTS_PER_WAKE; ++i) {
+    objects[i].state.fd = -1;
+    objects[i].calls = 0;
+    evented_set_handler(&objects[i].state, object_event, &objects[i]);
+    evented_set_stats(&objects[i].state, stats ? &handler_ns : NULL);
+    reactor_register(&reactor, &objects[i].state, IO_EVENT_READ);
+  }
+
+  uint64_t ns = 0;
+  for (int wake = 0; wake < wakes; ++wake) {
+    for (int i = 0; i < EVENTS_PER_WAKE; ++i) {
+      reactor_defer(&reactor, &objects[i].state, IO_EVENT_READ);
+    }
+
+    uint64_t start = clock_now_ns();
+    if (reactor_dispatch(&reactor, 0) != EVENTS_PER_WAKE) {
+      fprintf(stderr, "%s: unexpected number of events\n", name);
+      return -1;
+    }
+    ns += clock_now_ns() - start;
+  }
+
+  report(name, ns, wakes);
+  reactor_close(&reactor);
+  return 0;
+}
+
+// Signal every eventfd and dispatch the readiness reported by the backend
+static int run_eventfds(ReactorBackend backend, const char* name, int wakes) {
+  Reactor reactor;
+  if (reactor_init_backend(&reactor, backend) == -1) {
+    printf("%-30s unavailable: %s\n", name, strerror(errno));
+    return 0;
+  }
+
+  Object objects[EVENTS_PER_WAKE];
+  for (int i = 0; i < EVENTS_PER_WAKE; ++i) {
+    objects[i].state.fd = eventfd(0, EFD_NONBLOCK);
+    objects[i].calls = 0;
+    evented_set_handler(&objects[i].state, eventfd_event, &objects[i]);
+    evented_set_stats(&objects[i].state, NULL);
+    if (objects[i].state.fd == -1 || reactor_register(&reactor, &objects[i].state, IO_EVENT_READ) == -1) {
+      perror("eventfd");
+      return -1;
+    }
+  }
+
+  uint64_t ns = 0;
+  uint64_t one = 1;
+  int dispatched = 0;
+  for (int wake = 0; wake < wakes; ++wake) {
+    for (int i = 0; i < EVENTS_PER_WAKE; ++i) {
+      if (write(objects[i].state.fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("write");
+        return -1;
+      }
+    }
+
+    uint64_t start = clock_now_ns();
+    for (int n = 0; n < EVENTS_PER_WAKE; n += dispatched) {
+      dispatched = reactor_dispatch(&reactor, -1);
+      if (dispatched == -1) {
+        perror("dispatch");
+        return -1;
+      }
+    }
+    ns += clock_now_ns() - start;
+  }
+
+  report(name, ns, wakes);
+  for (int i = 0; i < EVENTS_PER_WAKE; ++i) {
+    reactor_deregister(&reactor, &objects[i].state);
+    close(objects[i].state.fd);
+  }
+  reactor_close(&reactor);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  int wakes = argc > 1 ? atoi(argv[1]) : 100000;
+  if (wakes <= 0) {
+    fprintf(stderr, "Usage: %s [wakes]\n", argv[0]);
+    return 1;
+  }
+
+  if (run_deferred(REACTOR_BACKEND_EPOLL, "deferred", false, wakes) == -1 ||
+      run_deferred(REACTOR_BACKEND_EPOLL, "deferred, handler stats", true, wakes) == -1 ||
+      run_eventfds(REACTOR_BACKEND_EPOLL, "eventfds, epoll", wakes / 10) == -1 ||
+      run_eventfds(REACTOR_BACKEND_IO_URING, "eventfds, io_uring", wakes / 10) == -1) {
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,256 @@
+// Thousands of simulated players against one worker, connected with server_connect_local()
+// Pairs of clients create and join lobbies, every player sends a CLIENT_UPDATE per tick and restarts
+// finished games, the clients run on the worker thread, so the process CPU time is the worker's own
+// Reports SERVER_UPDATEs delivered per player and second (62.5 at full rate), CPU time per tick
+// and the tick stage, for the in-memory pipe and AF_UNIX sockets
+// The server logs every connection, so stderr is best sent to /dev/null
+//
+// Usage: ./local_clients [clients] [seconds]
+
+#include "utils/log.c"
+#include "game/protocol.c"
+#include "game/vec2.c"
+#include "game/game.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
+#include "net/shared_buffer.c"
+#include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
+#include "net/tcp_listener.c"
+#include "net/unix_socket.c"
+#include "net/uring.c"
+#include "net/timer.c"
+#include "net/reactor.c"
+#include "server/pool.c"
+#include "server/simulation.c"
+#include "server/restart.c"
+#include "server/server.c"
+
+#include <stdio.h>
+
+#include <sys/resource.h>
+
+// The period of the server timer
+#define CLIENT_TICK_MS 16
+
+typedef struct Client {
+  TcpStream stream;
+  // The other player of the lobby, the even client of a pair owns it
+  struct Client* peer;
+  bool owner;
+  bool playing;
+  uint64_t updates;
+} Client;
+
+typedef struct {
+  Server* server;
+  Client* clients;
+  int n;
+  Timer tick;
+  Timer stop;
+} Driver;
+
+static int client_send(Client* client, const ClientMessage* message) {
+  char buffer[MAX_PACKET_SIZE];
+  int size = client_message_write(message, buffer, sizeof(buffer));
+  return tcp_start_send(&client->stream, buffer, size) == size ? 0 : -1;
+}
+
+static int client_handle(Client* client, const ServerMessage* message) {
+  ClientMessage reply;
+  switch (message->id) {
+    case LOBBY_CREATED:
+      reply.id = JOIN_LOBBY;
+      reply.join_lobby.id = message->lobby_created.id;
+      strcpy(reply.join_lobby.password, "bench");
+      return client_send(client->peer, &reply);
+
+    case LOBBY_JOINED:
+      client->playing = true;
+      return 0;
+
+    case SERVER_UPDATE:
+      client->updates++;
+      return 0;
+
+    case GAME_STATE_UPDATE:
+      if (!client->owner || message->game_state_update.state == STATE_RUNNING) {
+        return 0;
+      }
+
+      reply.id = CLIENT_STATE_UPDATE;
+      reply.client_state_update.state = CLIENT_STATE_RESTART;
+      return client_send(client, &reply);
+
+    default:
+      fprintf(stderr, "Unexpected message %#x\n", message->id);
+      return -1;
+  }
+}
+
+static int client_event(void* context, unsigned events) {
+  Client* client = context;
+  if (events & IO_EVENT_WRITE) {
+    if (tcp_send(&client->stream) == -1) {
+      return -1;
+    }
+  }
+
+  if (!(events & IO_EVENT_READ)) {
+    return 0;
+  }
+
+  if (tcp_recv(&client->stream) != 1) {
+    return -1;
+  }
+
+  char scratch[MAX_PACKET_SIZE];
+  int received = tcp_received(&client->stream);
+  while (received > 0) {
+    int n = received < MAX_PACKET_SIZE ? received : MAX_PACKET_SIZE;
+    ServerMessage message;
+    int size = server_message_read(&message, tcp_peek(&client->stream, n, scratch), n);
+    if (size <= 0) {
+      break;
+    }
+
+    if (client_handle(client, &message) == -1 || tcp_consume(&client->stream, size) == -1) {
+      return -1;
+    }
+    received -= size;
+  }
+
+  // readiness is an edge, the rest of the input is read on the next loop iteration
+  if (tcp_input_full(&client->stream)) {
+    reactor_defer(client->stream.reactor, &client->stream.state, IO_EVENT_READ);
+  }
+  return 0;
+}
+
+static void driver_tick(void* context) {
+  Driver* driver = context;
+  ClientMessage message = {.id = CLIENT_UPDATE};
+  for (int i = 0; i < driver->n; ++i) {
+    Client* client = &driver->clients[i];
+    if (!client->playing) {
+      continue;
+    }
+
+    // paddles bounce up and down, so the games keep changing
+    message.client_update.speed = (Vec2){0, (i + client->updates / 32) % 2 ? 1.0f : -1.0f};
+    if (client_send(client, &message) == -1) {
+      fprintf(stderr, "Client #%d failed to send: %s\n", i, strerror(errno));
+    }
+  }
+  reactor_schedule(&driver->server->reactor, &driver->tick, CLIENT_TICK_MS);
+}
+
+static void driver_stop(void* context) {
+  Driver* driver = context;
+  server_stop(driver->server);
+}
+
+static uint64_t cpu_time_ns(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 * 1000 * 1000 +
+         (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+static int run(const char* name, int (*pair)(TcpStream*, TcpStream*, Reactor*), int n, int seconds) {
+  ServerConfig config;
+  server_config_init(&config);
+  config.host = "127.0.0.1";
+  config.port = 0;
+  config.max_connections = n;
+  config.max_lobbies = n / 2;
+
+  Server* server = malloc(sizeof(Server));
+  Client* clients = calloc(n, sizeof(Client));
+  if (server == NULL || clients == NULL || server_init(server, &config, 0, server) == -1) {
+    perror("server_init");
+    return -1;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    Client* client = &clients[i];
+    client->owner = i % 2 == 0;
+    client->peer = &clients[i ^ 1];
+    if (server_connect_local(server, &client->stream, pair) == -1) {
+      perror("server_connect_local");
+      return -1;
+    }
+
+    evented_set_handler(&client->stream.state, client_event, client);
+    if (tcp_start_recv(&client->stream) == -1 || tcp_set_eager_send(&client->stream) == -1) {
+      perror("tcp_start_recv");
+      return -1;
+    }
+  }
+
+  ClientMessage create = {.id = CREATE_LOBBY};
+  strcpy(create.create_lobby.password, "bench");
+  for (int i = 0; i < n; i += 2) {
+    if (client_send(&clients[i], &create) == -1) {
+      perror("send");
+      return -1;
+    }
+  }
+
+  Driver driver = {.server = server, .clients = clients, .n = n};
+  timer_init(&driver.tick, driver_tick, &driver);
+  timer_init(&driver.stop, driver_stop, &driver);
+  reactor_schedule(&server->reactor, &driver.tick, CLIENT_TICK_MS);
+  // the first server tick comes a second after the start
+  reactor_schedule(&server->reactor, &driver.stop, (seconds + 1) * 1000);
+
+  uint64_t start_cpu_ns = cpu_time_ns();
+  if (server_run(server) == -1) {
+    return -1;
+  }
+  uint64_t cpu_ns = cpu_time_ns() - start_cpu_ns;
+
+  uint64_t updates = 0;
+  int playing = 0;
+  for (int i = 0; i < n; ++i) {
+    updates += clients[i].updates;
+    playing += clients[i].playing;
+  }
+
+  const Histogram* ticks = &server->stats.tick_ns;
+  printf("%-7s %6d clients (%d playing): %5.1f updates/s per player, %7.1f us CPU/tick, "
+         "tick stage avg %6.1f us, p99 %6.1f us\n",
+         name, n, playing, (double)updates / n / seconds, (double)cpu_ns / 1000 / (ticks->count ? ticks->count : 1),
+         histogram_avg(ticks) / 1000.0, histogram_percentile(ticks, 99) / 1000.0);
+
+  reactor_cancel(&server->reactor, &driver.tick);
+  for (int i = 0; i < n; ++i) {
+    tcp_close(&clients[i].stream);
+  }
+  server_close(server);
+  free(clients);
+  free(server);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 4000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 10;
+  if (n <= 0 || n % 2 != 0 || seconds <= 0) {
+    fprintf(stderr, "Usage: %s [clients, even] [seconds]\n", argv[0]);
+    return 1;
+  }
+
+  // AF_UNIX pairs take two descriptors per client
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  if (run("memory", tcp_memory_pair, n, seconds) == -1 || run("socket", tcp_socketpair, n, seconds) == -1) {
+    return 1;
+  }
+  return 0;
+}
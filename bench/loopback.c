@@ -0,0 +1,162 @@
+// Throughput of a TcpStream pair over loopback TCP, both ends on one reactor
+// The sender queues messages of a fixed size with eager send, the ring buffer takes what the socket doesn't
+// and is drained on IO_EVENT_WRITE, the receiver reads with readv() and consumes whole messages
+//
+// Usage: ./loopback [megabytes]
+
+#include "utils/log.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
+#include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
+#include "net/uring.c"
+#include "net/timer.c"
+#include "net/reactor.c"
+
+#include <stdio.h>
+
+#include <fcntl.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef struct {
+  TcpStream sender;
+  TcpStream receiver;
+  int message_size;
+  uint64_t total;
+  uint64_t queued;
+  uint64_t received;
+  // Times the output buffer was full, so the sender had to wait for IO_EVENT_WRITE
+  uint64_t stalls;
+} Pair;
+
+// Queue messages till the output buffer can't take more
+static int pair_fill(Pair* pair) {
+  static char message[64 * 1024];
+  while (pair->queued < pair->total) {
+    int n = tcp_start_send(&pair->sender, message, pair->message_size);
+    if (n == -1) {
+      return -1;
+    }
+
+    if (n == 0) {
+      pair->stalls++;
+      break;
+    }
+    pair->queued += n;
+  }
+  return 0;
+}
+
+static int sender_event(void* context, unsigned events) {
+  Pair* pair = context;
+  if (!(events & IO_EVENT_WRITE)) {
+    return 0;
+  }
+
+  if (tcp_send(&pair->sender) == -1) {
+    return -1;
+  }
+  return pair_fill(pair);
+}
+
+static int receiver_event(void* context, unsigned events) {
+  Pair* pair = context;
+  if (!(events & IO_EVENT_READ)) {
+    return 0;
+  }
+
+  if (tcp_recv(&pair->receiver) != 1) {
+    return -1;
+  }
+
+  // edge-triggered polling won't report the data left in the socket
+  if (tcp_input_full(&pair->receiver)) {
+    reactor_defer(pair->receiver.reactor, &pair->receiver.state, IO_EVENT_READ);
+  }
+
+  int n = tcp_received(&pair->receiver);
+  n -= n % pair->message_size;
+  pair->received += n;
+  return tcp_consume(&pair->receiver, n);
+}
+
+// Connect a loopback TCP pair, both ends non-blocking
+static int connect_pair(Reactor* reactor, Pair* pair) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t size = sizeof(address);
+  if (listener == -1 || bind(listener, (struct sockaddr*)&address, size) == -1 || listen(listener, 1) == -1 ||
+      getsockname(listener, (struct sockaddr*)&address, &size) == -1) {
+    return -1;
+  }
+
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  if (client == -1 || connect(client, (struct sockaddr*)&address, size) == -1) {
+    return -1;
+  }
+
+  int server = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+  close(listener);
+  if (server == -1 || fcntl(client, F_SETFL, O_NONBLOCK) == -1) {
+    return -1;
+  }
+
+  if (tcp_from_socket(&pair->sender, reactor, server) == -1 || tcp_from_socket(&pair->receiver, reactor, client) == -1) {
+    return -1;
+  }
+
+  evented_set_handler(&pair->sender.state, sender_event, pair);
+  evented_set_handler(&pair->receiver.state, receiver_event, pair);
+  return tcp_set_eager_send(&pair->sender) == -1 || tcp_start_recv(&pair->receiver) == -1 ? -1 : 0;
+}
+
+static int run(int message_size, uint64_t total) {
+  Reactor reactor;
+  Pair pair = {.message_size = message_size, .total = total - total % message_size};
+  if (reactor_init(&reactor) == -1 || connect_pair(&reactor, &pair) == -1) {
+    perror("connect");
+    return -1;
+  }
+
+  uint64_t start = clock_now_ns();
+  if (pair_fill(&pair) == -1) {
+    perror("send");
+    return -1;
+  }
+
+  while (pair.received < pair.total) {
+    if (reactor_dispatch(&reactor, -1) == -1) {
+      perror("dispatch");
+      return -1;
+    }
+  }
+
+  double seconds = (clock_now_ns() - start) / 1e9;
+  printf("%6d B messages: %8.1f MB/s, %10.0f messages/s, %llu output stalls\n", message_size,
+         pair.total / seconds / (1024 * 1024), pair.total / message_size / seconds, (unsigned long long)pair.stalls);
+
+  tcp_close(&pair.sender);
+  tcp_close(&pair.receiver);
+  reactor_close(&reactor);
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  int megabytes = argc > 1 ? atoi(argv[1]) : 256;
+  if (megabytes <= 0) {
+    fprintf(stderr, "Usage: %s [megabytes]\n", argv[0]);
+    return 1;
+  }
+
+  // SERVER_UPDATE, the largest message and bulk transfer
+  const int sizes[] = {28, 258, 4096, 32 * 1024};
+  for (int i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i) {
+    if (run(sizes[i], (uint64_t)megabytes * 1024 * 1024) == -1) {
+      return 1;
+    }
+  }
+  return 0;
+}
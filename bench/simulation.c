@@ -0,0 +1,115 @@
+// Scaling of the simulation stage of a tick with the number of simulation threads
+// Steps the games of |lobbies| running lobbies with the job of the server (server_simulate_lobby())
+// on simulation_pool_run(), from the calling thread alone up to |max threads| helpers
+// The calling thread is participant #0, as the network thread of a worker is, so N helpers use N + 1 cores
+// Finished games are restarted between ticks, so every lobby is stepped on every tick
+// The snapshots are serialized by the network thread when it flushes, the cost of that is reported last
+//
+// Usage: ./simulation [lobbies] [ticks] [max threads]
+
+#include "utils/log.c"
+#include "game/protocol.c"
+#include "game/vec2.c"
+#include "game/game.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
+#include "net/shared_buffer.c"
+#include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
+#include "net/tcp_listener.c"
+#include "net/unix_socket.c"
+#include "net/uring.c"
+#include "net/timer.c"
+#include "net/reactor.c"
+#include "server/pool.c"
+#include "server/simulation.c"
+#include "server/restart.c"
+#include "server/server.c"
+
+#include <stdio.h>
+
+// Runs a batch of |n| lobbies with |n_threads| helpers
+// returns: ns per tick, -1 on error
+static double run(Lobby** lobbies, int n, int ticks, int n_threads, double* steals) {
+  SimulationPool pool;
+  if (simulation_pool_init(&pool, n_threads) == -1) {
+    return -1;
+  }
+
+  SimulationBatch batch = {.lobbies = lobbies, .steps = 1};
+  uint64_t total_ns = 0;
+  for (int tick = 0; tick < ticks; ++tick) {
+    uint64_t start = clock_now_ns();
+    simulation_pool_run(&pool, n, server_simulate_lobby, &batch);
+    total_ns += clock_now_ns() - start;
+
+    for (int i = 0; i < n; ++i) {
+      if (lobbies[i]->game.state != STATE_RUNNING) {
+        game_event(&lobbies[i]->game, EVENT_RESTART);
+      }
+    }
+  }
+
+  *steals = (double)atomic_load(&pool.steals) / ticks;
+  simulation_pool_close(&pool);
+  return (double)total_ns / ticks;
+}
+
+int main(int argc, char* argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : 10000;
+  int ticks = argc > 2 ? atoi(argv[2]) : 1000;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = argc > 3 ? atoi(argv[3]) : (cores > 1 ? cores - 1 : 1);
+  if (n <= 0 || ticks <= 0 || max_threads < 0) {
+    fprintf(stderr, "Usage: %s [lobbies] [ticks] [max threads]\n", argv[0]);
+    return 1;
+  }
+
+  // separate allocations, as lobbies of a worker are spread over its pool
+  Lobby** lobbies = malloc(n * sizeof(Lobby*));
+  for (int i = 0; i < n; ++i) {
+    lobbies[i] = malloc(sizeof(Lobby));
+    lobby_init(lobbies[i], NULL, "bench");
+    // paddles of every game move differently, so the games don't run in lockstep
+    lobbies[i]->game.player.speed = (Vec2){0, (i % 7 - 3) * 0.1f};
+  }
+
+  printf("%d lobbies, %ld cores\n", n, cores);
+  double base_ns = 0;
+  for (int n_threads = 0; n_threads <= max_threads; ++n_threads) {
+    double steals = 0;
+    double ns = run(lobbies, n, ticks, n_threads, &steals);
+    if (ns < 0) {
+      perror("simulation_pool_init");
+      return 1;
+    }
+
+    base_ns = n_threads == 0 ? ns : base_ns;
+    printf("%2d threads (%2d participants): %9.1f us/tick, %6.1f ns/lobby, speedup %5.2f, %6.1f steals/tick\n",
+           n_threads, n_threads + 1, ns / 1000, ns / n, base_ns / ns, steals);
+  }
+
+  // what the flush of the network thread adds per lobby: a SERVER_UPDATE for each player
+  char packet[MAX_PACKET_SIZE];
+  ServerMessage message = {.id = SERVER_UPDATE};
+  uint64_t bytes = 0;
+  uint64_t start = clock_now_ns();
+  for (int tick = 0; tick < ticks; ++tick) {
+    for (int i = 0; i < n; ++i) {
+      message.server_update = lobbies[i]->owner_update;
+      bytes += server_message_write(&message, packet, sizeof(packet));
+      message.server_update = lobbies[i]->guest_update;
+      bytes += server_message_write(&message, packet, sizeof(packet));
+    }
+  }
+  double ns = (double)(clock_now_ns() - start) / ticks;
+  printf("serializing snapshots:          %9.1f us/tick, %6.1f ns/lobby (%llu bytes)\n",
+         ns / 1000, ns / n, (unsigned long long)bytes);
+
+  for (int i = 0; i < n; ++i) {
+    free(lobbies[i]);
+  }
+  free(lobbies);
+  return 0;
+}
@@ -12,7 +12,30 @@
 #define DEFAULT_WINDOW_WIDTH 800
 #define DEFAULT_WINDOW_HEIGHT 600
 
-#define RECONNECT_DELAY 1000 * 3
+#define RECONNECT_DELAY (1000 * 3)
+
+static void reconnect(void* context) {
+  Pong* pong = context;
+  if (tcp_init(&pong->tcp_stream, &pong->reactor) == -1) {
+    LOG_ERROR("Failed to create socket: %s", strerror(errno));
+    reactor_schedule(&pong->reactor, &pong->reconnect_timer, RECONNECT_DELAY);
+    return;
+  }
+
+  LOG_INFO("Reconnecting to %s:%d", pong->connection_state.ip, pong->connection_state.port);
+  pong->connection_state.state = DISCONNECTED;
+}
+
+// Drop failed connection attempt and retry it after RECONNECT_DELAY
+static void schedule_reconnect(Pong* pong) {
+  tcp_close(&pong->tcp_stream);
+  // messages queued for the failed connection are lost, they have to be sent again
+  if (pong->game_session.state == WAITING_FOR_LOBBY) {
+    pong->game_session.state = pong->game_session.id == -1 ? NOT_IN_LOBBY : WANT_TO_JOIN;
+  }
+  pong->connection_state.state = AWAITING_RECONNECT;
+  reactor_schedule(&pong->reactor, &pong->reconnect_timer, RECONNECT_DELAY);
+}
 
 int pong_init(Pong* pong, Args* params) {
   pong->running = false;
@@ -43,6 +66,7 @@ int pong_init(Pong* pong, Args* params) {
   pong->connection_state.port = params->port;
 
   tcp_init(&pong->tcp_stream, &pong->reactor);
+  timer_init(&pong->reconnect_timer, reconnect, pong);
 
   pong->game_session.id = params->lobby_id;
   strcpy(pong->game_session.password, params->password);
@@ -75,16 +99,18 @@ void pong_close(Pong* pong) {
 }
 
 static int prepare_and_send(Pong* pong, const ClientMessage* msg) {
-  char buf[MAX_MESSAGE_SIZE];
-
-  int n = client_message_write(msg, buf, sizeof(buf));
+  // serialized right into the output buffer, unless the queued output leaves no room there
+  char scratch[MAX_PACKET_SIZE];
+  char* reserved = tcp_reserve(&pong->tcp_stream, MAX_PACKET_SIZE);
+  char* buf = reserved != NULL ? reserved : scratch;
+  int n = client_message_write(msg, buf, MAX_PACKET_SIZE);
 
   if (n == 0) {
     return -1;
   }
 
-  int send_res = tcp_start_send(&pong->tcp_stream, buf, n);
-  if (send_res <= 0) {
+  int send_res = reserved != NULL ? tcp_commit(&pong->tcp_stream, n) : tcp_start_send(&pong->tcp_stream, scratch, n);
+  if (send_res == -1 || (reserved == NULL && send_res == 0)) {
     LOG_WARN("Send operation failed with code: %d, msg: %s", send_res, strerror(errno));
     return -1;
   }
@@ -260,13 +286,13 @@ static int process_read(Pong* pong) {
       return -1;
     }
 
-    bool more_to_read = false;
-    int offset = 0;
     while (true) {
       ServerMessage message;
+      char scratch[MAX_PACKET_SIZE];
+      int available = tcp_received(&pong->tcp_stream);
+      available = available < MAX_PACKET_SIZE ? available : MAX_PACKET_SIZE;
 
-      int msg_size = server_message_read(&message, pong->tcp_stream.input + offset,
-          pong->tcp_stream.received - offset);
+      int msg_size = server_message_read(&message, tcp_peek(&pong->tcp_stream, available, scratch), available);
 
       if (msg_size < 0) {
         LOG_WARN("Invalid message received from server");
@@ -279,21 +305,14 @@ static int process_read(Pong* pong) {
       }
 
       process_server_message(pong, &message);
+      tcp_consume(&pong->tcp_stream, msg_size);
 
-      offset += msg_size;
-
-      if (offset == pong->tcp_stream.received) {
+      if (tcp_received(&pong->tcp_stream) == 0) {
         break;
       }
     }
 
-    tcp_consume(&pong->tcp_stream, offset);
-
-    if (pong->tcp_stream.received == sizeof(pong->tcp_stream.input)) {
-      more_to_read = true;
-    }
-
-    if (!more_to_read) {
+    if (!tcp_input_full(&pong->tcp_stream)) {
       break;
     }
   }
@@ -305,7 +324,10 @@ static int process_read(Pong* pong) {
 static int pong_process_network(Pong* pong, int timeout_ms) {
   unsigned now = SDL_GetTicks();
   unsigned deadline = now + timeout_ms;
-  prepare_client_message(pong);
+  // there is no socket to queue messages into until reconnect
+  if (pong->connection_state.state != AWAITING_RECONNECT) {
+    prepare_client_message(pong);
+  }
 
   while (now < deadline) {
     unsigned time_left = deadline - now;
@@ -315,6 +337,7 @@ static int pong_process_network(Pong* pong, int timeout_ms) {
                             pong->connection_state.ip,
                             pong->connection_state.port) == -1) {
         LOG_ERROR("Failed to start connection: %s", strerror(errno));
+        schedule_reconnect(pong);
         return -1;
       }
       pong->connection_state.state = AWAITING_CONNECTION;
@@ -326,6 +349,12 @@ static int pong_process_network(Pong* pong, int timeout_ms) {
       return -1;
     }
 
+    if (n == 0) {
+      // timed out (or only timers have fired)
+      now = SDL_GetTicks();
+      continue;
+    }
+
 
     if (event.events & IO_EVENT_READ) {
       if (process_read(pong) == -1) {
@@ -344,8 +373,8 @@ static int pong_process_network(Pong* pong, int timeout_ms) {
           pong->connection_state.state = CONNECTED;
           tcp_start_recv(&pong->tcp_stream);
         } else {
-          LOG_WARN("tcp connect failed");
-          pong->connection_state.state = DISCONNECTED;
+          LOG_WARN("tcp connect failed, retrying in %d ms", RECONNECT_DELAY);
+          schedule_reconnect(pong);
           return -1;
         }
 
@@ -16,6 +16,8 @@ enum { // Connection State
   DISCONNECTED,
   // Connect is triggered, but we still waiting for connection to server
   AWAITING_CONNECTION,
+  // Connection attempt failed, waiting for reconnect timer
+  AWAITING_RECONNECT,
   // Connected to the game server
   CONNECTED
 };
@@ -63,6 +65,8 @@ typedef struct Pong {
   ConnectionState connection_state;
   // Connection to the game server
   TcpStream tcp_stream;
+  // Fires when it's time to retry failed connection attempt
+  Timer reconnect_timer;
   // State of the remote game session
   GameSession game_session;
 } Pong;
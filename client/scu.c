@@ -3,8 +3,14 @@
 #include "game/game.c"
 #include "game/vec2.c"
 #include "game/protocol.c"
+#include "net/uring.c"
+#include "net/timer.c"
 #include "net/reactor.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
 #include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
 #include "renderer/vgl.c"
 #include "renderer/shader.c"
 #include "renderer/buffer.c"
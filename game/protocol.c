@@ -82,6 +82,10 @@ static int read_message(void* message, const char* data, size_t size, bool is_se
         READ(client_message->join_lobby.id);
         READ_ENDING_STR(client_message->join_lobby.password);
         break;
+      case SPECTATE_LOBBY:
+        READ(client_message->spectate_lobby.id);
+        READ_ENDING_STR(client_message->spectate_lobby.password);
+        break;
       case CLIENT_UPDATE:
         READ(client_message->client_update.speed);
         break;
@@ -176,6 +180,10 @@ static int write_message(const void* message, char* data, size_t size, bool is_s
         WRITE(client_message->join_lobby.id);
         WRITE_STR(client_message->join_lobby.password);
         break;
+      case SPECTATE_LOBBY:
+        WRITE(client_message->spectate_lobby.id);
+        WRITE_STR(client_message->spectate_lobby.password);
+        break;
       case CLIENT_UPDATE:
         WRITE(client_message->client_update.speed);
         break;
@@ -6,6 +6,10 @@
 #include "vec2.h"
 
 #define MAX_MESSAGE_SIZE 256
+// Messages start with u16 length of the payload and u16 id
+#define MESSAGE_HEADER_SIZE 4
+// The largest message including its header
+#define MAX_PACKET_SIZE (MESSAGE_HEADER_SIZE + MAX_MESSAGE_SIZE)
 #define MAX_PASSWORD_SIZE 32
 
 typedef enum {
@@ -16,6 +20,7 @@ typedef enum {
   JOIN_LOBBY = 0x1,
   CLIENT_UPDATE = 0x2,
   CLIENT_STATE_UPDATE = 0x3,
+  SPECTATE_LOBBY = 0x4,
 
   // server messages
   LOBBY_CREATED = 0x10,
@@ -42,7 +47,12 @@ typedef struct {
   char password[MAX_PASSWORD_SIZE];
 } JoinLobby;
 
-// Sent in response to JoinLobby message
+// Watch existing lobby, the same fields as JoinLobby
+// The spectator gets SERVER_UPDATEs and GAME_STATE_UPDATEs as the owner of the lobby sees them,
+// its CLIENT_UPDATEs are rejected
+typedef JoinLobby SpectateLobby;
+
+// Sent in response to JoinLobby and SpectateLobby messages
 // and also to the owner of game lobby when someone joins
 typedef struct {
   // ip address of opponent
@@ -112,6 +122,7 @@ typedef struct {
   union {
     CreateLobby create_lobby;
     JoinLobby join_lobby;
+    SpectateLobby spectate_lobby;
     ClientUpdate client_update;
     ClientStateUpdate client_state_update;
   };
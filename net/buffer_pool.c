@@ -0,0 +1,44 @@
+#include "buffer_pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+
+void buffer_pool_init(BufferPool* pool, int block_size, int max_free) {
+  assert(block_size >= (int)sizeof(void*));
+  pool->block_size = block_size;
+  pool->free = NULL;
+  pool->n_free = 0;
+  pool->max_free = max_free;
+}
+
+void buffer_pool_close(BufferPool* pool) {
+  while (pool->free != NULL) {
+    void* next = *(void**)pool->free;
+    free(pool->free);
+    pool->free = next;
+  }
+  pool->n_free = 0;
+}
+
+char* buffer_pool_acquire(BufferPool* pool) {
+  if (pool->free == NULL) {
+    return malloc(pool->block_size);
+  }
+
+  char* block = pool->free;
+  pool->free = *(void**)block;
+  pool->n_free--;
+  return block;
+}
+
+void buffer_pool_release(BufferPool* pool, char* block) {
+  if (pool->n_free >= pool->max_free) {
+    free(block);
+    return;
+  }
+
+  *(void**)block = pool->free;
+  pool->free = block;
+  pool->n_free++;
+}
@@ -0,0 +1,25 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+// Cache of fixed-size I/O blocks shared by the streams of a worker,
+// a stream holds a block only while it has unread input or unsent output
+// Every block is a separate allocation, so it may be released to another pool
+// (e.g. after the stream was handed over to another worker) or simply free()d
+typedef struct BufferPool {
+  int block_size;
+  // Free blocks, linked through their first bytes
+  void* free;
+  int n_free;
+  // Free blocks above this number go back to the allocator
+  int max_free;
+} BufferPool;
+
+void buffer_pool_init(BufferPool* pool, int block_size, int max_free);
+// Free cached blocks, blocks which are in use stay valid
+void buffer_pool_close(BufferPool* pool);
+
+// returns: a block of |pool->block_size| bytes, NULL if out of memory
+char* buffer_pool_acquire(BufferPool* pool);
+void buffer_pool_release(BufferPool* pool, char* block);
+
+#endif // BUFFER_POOL_H
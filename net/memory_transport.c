@@ -0,0 +1,193 @@
+#include "transport.h"
+#include "tcp_stream.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+
+// Capacity of every direction of the pipe, it plays the role of socket buffers
+#define MEMORY_PIPE_SIZE (64 * 1024)
+
+// Bidirectional pipe between two streams of one process
+// Readiness is reported through reactor_defer(), the same way edge-triggered polling does:
+// once when data (or end of stream) arrives and once when a blocked writer gets space back
+typedef struct MemoryPipe {
+  // Ends of the pipe, NULL once closed
+  TcpStream* ends[2];
+  // Data flowing to ends[i]
+  RingBuffer buffers[2];
+  // ends[i] won't write anymore
+  bool closed[2];
+  // ends[i] has hit a full buffer and waits for IO_EVENT_WRITE
+  bool blocked[2];
+} MemoryPipe;
+
+static int memory_end(TcpStream* stream) {
+  MemoryPipe* pipe = stream->transport_data;
+  return pipe->ends[0] == stream ? 0 : 1;
+}
+
+// Report |events| to the end #|end| if it's subscribed to them
+static void memory_notify(MemoryPipe* pipe, int end, unsigned events) {
+  TcpStream* stream = pipe->ends[end];
+  if (stream != NULL && (stream->state.events & events)) {
+    reactor_defer(stream->reactor, &stream->state, stream->state.events & events);
+  }
+}
+
+static ssize_t memory_readv(TcpStream* stream, const struct iovec* iov, int iovcnt) {
+  MemoryPipe* pipe = stream->transport_data;
+  int end = memory_end(stream);
+  RingBuffer* buffer = &pipe->buffers[end];
+  if (ring_buffer_size(buffer) == 0) {
+    if (pipe->closed[1 - end]) {
+      return 0;
+    }
+
+    errno = EAGAIN;
+    return -1;
+  }
+
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt && ring_buffer_size(buffer) != 0; ++i) {
+    int n = ring_buffer_size(buffer) < (int)iov[i].iov_len ? ring_buffer_size(buffer) : (int)iov[i].iov_len;
+    ring_buffer_read(buffer, iov[i].iov_base, n);
+    total += n;
+  }
+
+  if (pipe->blocked[1 - end]) {
+    pipe->blocked[1 - end] = false;
+    memory_notify(pipe, 1 - end, IO_EVENT_WRITE);
+  }
+
+  return total;
+}
+
+static ssize_t memory_writev(TcpStream* stream, const struct iovec* iov, int iovcnt) {
+  MemoryPipe* pipe = stream->transport_data;
+  int end = memory_end(stream);
+  if (pipe->closed[1 - end]) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  RingBuffer* buffer = &pipe->buffers[1 - end];
+  if (ring_buffer_space(buffer) == 0) {
+    pipe->blocked[end] = true;
+    errno = EAGAIN;
+    return -1;
+  }
+
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    int n = ring_buffer_space(buffer) < (int)iov[i].iov_len ? ring_buffer_space(buffer) : (int)iov[i].iov_len;
+    ring_buffer_write(buffer, iov[i].iov_base, n);
+    total += n;
+    if (n != (int)iov[i].iov_len) {
+      pipe->blocked[end] = true;
+      break;
+    }
+  }
+
+  memory_notify(pipe, 1 - end, IO_EVENT_READ);
+  return total;
+}
+
+static int memory_update(TcpStream* stream, unsigned events) {
+  MemoryPipe* pipe = stream->transport_data;
+  int end = memory_end(stream);
+  unsigned added = events & ~stream->state.events;
+  if (reactor_update(stream->reactor, &stream->state, events) == -1) {
+    return -1;
+  }
+
+  // like epoll_ctl(), report readiness which is already there
+  unsigned ready = 0;
+  if ((added & IO_EVENT_READ) && (ring_buffer_size(&pipe->buffers[end]) != 0 || pipe->closed[1 - end])) {
+    ready |= IO_EVENT_READ;
+  }
+  if ((added & IO_EVENT_WRITE) && ring_buffer_space(&pipe->buffers[1 - end]) != 0) {
+    ready |= IO_EVENT_WRITE;
+  }
+
+  if (ready != 0) {
+    reactor_defer(stream->reactor, &stream->state, ready);
+  }
+  return 0;
+}
+
+static void memory_shutdown(TcpStream* stream) {
+  MemoryPipe* pipe = stream->transport_data;
+  int end = memory_end(stream);
+  reactor_deregister(stream->reactor, &stream->state);
+  stream->state.events = 0;
+  if (!pipe->closed[end]) {
+    pipe->closed[end] = true;
+    memory_notify(pipe, 1 - end, IO_EVENT_READ);
+  }
+}
+
+static void memory_close(TcpStream* stream) {
+  MemoryPipe* pipe = stream->transport_data;
+  int end = memory_end(stream);
+  memory_shutdown(stream);
+  pipe->ends[end] = NULL;
+
+  if (pipe->ends[1 - end] == NULL) {
+    ring_buffer_free(&pipe->buffers[0]);
+    ring_buffer_free(&pipe->buffers[1]);
+    free(pipe);
+  }
+}
+
+const TransportOps MEMORY_TRANSPORT = {
+  .name = "memory",
+  .readv = memory_readv,
+  .writev = memory_writev,
+  .update = memory_update,
+  .shutdown = memory_shutdown,
+  .close = memory_close,
+  // the pipe points to both streams and is not synchronized
+  .movable = false,
+};
+
+int tcp_memory_pair(TcpStream* first, TcpStream* second, Reactor* reactor) {
+  MemoryPipe* pipe = malloc(sizeof(MemoryPipe));
+  if (pipe == NULL) {
+    return -1;
+  }
+
+  if (ring_buffer_init(&pipe->buffers[0], MEMORY_PIPE_SIZE, MEMORY_PIPE_SIZE) == -1) {
+    free(pipe);
+    return -1;
+  }
+
+  if (ring_buffer_init(&pipe->buffers[1], MEMORY_PIPE_SIZE, MEMORY_PIPE_SIZE) == -1) {
+    ring_buffer_free(&pipe->buffers[0]);
+    free(pipe);
+    return -1;
+  }
+
+  pipe->ends[0] = first;
+  pipe->ends[1] = second;
+  for (int i = 0; i < 2; ++i) {
+    pipe->closed[i] = false;
+    pipe->blocked[i] = false;
+  }
+
+  if (tcp_from_transport(first, reactor, -1, &MEMORY_TRANSPORT, pipe) == -1) {
+    ring_buffer_free(&pipe->buffers[0]);
+    ring_buffer_free(&pipe->buffers[1]);
+    free(pipe);
+    return -1;
+  }
+
+  if (tcp_from_transport(second, reactor, -1, &MEMORY_TRANSPORT, pipe) == -1) {
+    // closing the only end frees the pipe
+    pipe->ends[1] = NULL;
+    tcp_close(first);
+    return -1;
+  }
+
+  return 0;
+}
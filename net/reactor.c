@@ -2,24 +2,83 @@
 
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdbool.h>
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
+#include "clock.h"
+
+
+// Size of io_uring submission queue
+static const unsigned URING_ENTRIES = 256;
 
 int reactor_init(Reactor* reactor) {
-  int poll = epoll_create(1);
-  if (poll == -1) {
+  return reactor_init_backend(reactor, REACTOR_BACKEND_EPOLL);
+}
+
+static int reactor_init_wakeup(Reactor* reactor);
+static void reactor_discard_tasks(Reactor* reactor);
+
+int reactor_init_backend(Reactor* reactor, ReactorBackend backend) {
+  reactor->backend = backend;
+  reactor->poll = -1;
+  timer_wheel_init(&reactor->timers, clock_now_ms());
+  reactor->ready_head = NULL;
+  reactor->ready_tail = NULL;
+  memset(&reactor->stats, 0, sizeof(reactor->stats));
+
+  int status = -1;
+  switch (backend) {
+    case REACTOR_BACKEND_EPOLL: {
+      int poll = epoll_create(1);
+      if (poll == -1) {
+        return -1;
+      }
+
+      reactor->poll = poll;
+      status = 0;
+      break;
+    }
+    case REACTOR_BACKEND_IO_URING:
+      status = uring_init(&reactor->ring, URING_ENTRIES);
+      break;
+    default:
+      errno = EINVAL;
+      break;
+  }
+
+  if (status == -1) {
+    return -1;
+  }
+
+  if (reactor_init_wakeup(reactor) == -1) {
+    int error = errno;
+    reactor_close(reactor);
+    errno = error;
     return -1;
   }
 
-  reactor->poll = poll;
   return 0;
 }
 
 void reactor_close(Reactor* reactor) {
-  close(reactor->poll);
+  if (reactor->wakeup.fd != -1) {
+    reactor_deregister(reactor, &reactor->wakeup);
+    close(reactor->wakeup.fd);
+    reactor_discard_tasks(reactor);
+  }
+
+  switch (reactor->backend) {
+    case REACTOR_BACKEND_EPOLL:
+      close(reactor->poll);
+      break;
+    case REACTOR_BACKEND_IO_URING:
+      uring_close(&reactor->ring);
+      break;
+  }
 }
 
 // Checks if |object| is already subscribed to |events|
@@ -27,19 +86,24 @@ static bool is_subscribed(Evented* object, unsigned events) {
   return object->events == events;
 }
 
-// Convert reactor events to epoll events
-static unsigned to_epoll(unsigned events) {
-  unsigned epoll_events = EPOLLET;
+// Convert reactor events to poll events
+static unsigned to_poll(unsigned events) {
+  unsigned poll_events = 0;
 
   if (events & IO_EVENT_READ) {
-    epoll_events |= EPOLLIN;
+    poll_events |= EPOLLIN;
   }
 
   if (events & IO_EVENT_WRITE) {
-    epoll_events |= EPOLLOUT;
+    poll_events |= EPOLLOUT;
   }
 
-  return epoll_events;
+  return poll_events;
+}
+
+// Convert reactor events to epoll events
+static unsigned to_epoll(unsigned events) {
+  return to_poll(events) | EPOLLET;
 }
 
 // Convert epoll events to reactor events
@@ -57,11 +121,229 @@ static unsigned to_reactor(unsigned epoll_events) {
   return events;
 }
 
-int reactor_register(Reactor* reactor, Evented* object, unsigned events) {
+// epoll backend
+
+static int epoll_register(Reactor* reactor, Evented* object, unsigned events) {
+  reactor->stats.epoll_calls++;
   struct epoll_event event;
   event.events = to_epoll(events);
   event.data.ptr = object;
-  if (epoll_ctl(reactor->poll, EPOLL_CTL_ADD, object->fd, &event) == -1) {
+  return epoll_ctl(reactor->poll, EPOLL_CTL_ADD, object->fd, &event);
+}
+
+static int epoll_update(Reactor* reactor, Evented* object, unsigned events) {
+  reactor->stats.epoll_calls++;
+  struct epoll_event event;
+  event.events = to_epoll(events);
+  event.data.ptr = object;
+  return epoll_ctl(reactor->poll, EPOLL_CTL_MOD, object->fd, &event);
+}
+
+static int epoll_deregister(Reactor* reactor, Evented* object) {
+  reactor->stats.epoll_calls++;
+  return epoll_ctl(reactor->poll, EPOLL_CTL_DEL, object->fd, NULL);
+}
+
+static int epoll_poll(Reactor* reactor, IOEvent* events, int n_events, int timeout_ms) {
+  static const int MAX_EVENTS = 64;
+  struct epoll_event epoll_events[MAX_EVENTS];
+  // TODO: handle this case properly
+  if (n_events > MAX_EVENTS) {
+    n_events = MAX_EVENTS;
+  }
+
+  reactor->stats.epoll_calls++;
+  int n = epoll_wait(reactor->poll, epoll_events, n_events, timeout_ms);
+  if (n == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    events[i].events = to_reactor(epoll_events[i].events);
+    events[i].object = epoll_events[i].data.ptr;
+  }
+
+  return n;
+}
+
+// io_uring backend
+//
+// Every subscribed object has exactly one multishot poll request in flight
+// (user_data is a pointer to the object). Multishot polls are edge-triggered,
+// which matches EPOLLET semantics of epoll backend. Subscription changes only
+// prepare submission entries, they are submitted by the next uring_poll().
+//
+// The kernel refuses to update a poll which is busy posting an event (-EALREADY),
+// so completions of updates are tagged with URING_UPDATE_TAG and refused ones are retried.
+
+// Objects are aligned, so the lowest bit of their address is free
+#define URING_UPDATE_TAG ((__u64)1)
+
+// Arm a new multishot poll for |object|
+static int uring_arm(Reactor* reactor, Evented* object, unsigned events) {
+  struct io_uring_sqe* sqe = uring_get_sqe(&reactor->ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = object->fd;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = to_poll(events);
+  sqe->user_data = (__u64)(uintptr_t)object;
+  return 0;
+}
+
+// Cancel poll request of |object|, or update its events if |events| is not 0
+static int uring_disarm(Reactor* reactor, Evented* object, unsigned events) {
+  struct io_uring_sqe* sqe = uring_get_sqe(&reactor->ring);
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = (__u64)(uintptr_t)object;
+  // completion of a removal is not interesting, the one of an update tells if it has to be retried
+  sqe->user_data = 0;
+  if (events != 0) {
+    sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = to_poll(events);
+    sqe->user_data = (__u64)(uintptr_t)object | URING_UPDATE_TAG;
+  }
+  return 0;
+}
+
+static int uring_register(Reactor* reactor, Evented* object, unsigned events) {
+  if (events == 0) {
+    return 0;
+  }
+
+  return uring_arm(reactor, object, events);
+}
+
+static int uring_update(Reactor* reactor, Evented* object, unsigned events) {
+  if (object->events == 0) {
+    return uring_arm(reactor, object, events);
+  }
+
+  return uring_disarm(reactor, object, events);
+}
+
+static int uring_deregister(Reactor* reactor, Evented* object) {
+  if (object->events != 0) {
+    if (uring_disarm(reactor, object, 0) == -1) {
+      return -1;
+    }
+
+    // the object memory could be reused right after this call,
+    // so cancellation must reach the kernel right now
+    if (uring_enter(&reactor->ring, 0, 0) == -1) {
+      return -1;
+    }
+  }
+
+  // forget about completions which were already posted for this object
+  Uring* ring = &reactor->ring;
+  unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+  for (unsigned i = *ring->cq_head; i != tail; ++i) {
+    struct io_uring_cqe* cqe = &ring->cqes[i & *ring->cq_mask];
+    if ((cqe->user_data & ~URING_UPDATE_TAG) == (__u64)(uintptr_t)object) {
+      cqe->user_data = 0;
+    }
+  }
+
+  object->events = 0;
+  return 0;
+}
+
+static int uring_poll(Reactor* reactor, IOEvent* events, int n_events, int timeout_ms) {
+  Uring* ring = &reactor->ring;
+  // completions are posted to the shared ring, a non-blocking poll with nothing to submit needs no syscall
+  bool peek_only = timeout_ms == 0 && ring->to_submit == 0;
+  if (!peek_only && uring_enter(ring, 1, timeout_ms) == -1) {
+    return -1;
+  }
+
+  int n = 0;
+  struct io_uring_cqe* cqe = NULL;
+  while (n < n_events && (cqe = uring_peek_cqe(ring)) != NULL) {
+    Evented* object = (Evented*)(uintptr_t)(cqe->user_data & ~URING_UPDATE_TAG);
+    bool update = cqe->user_data & URING_UPDATE_TAG;
+    int res = cqe->res;
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    uring_advance(ring, 1);
+
+    if (object == NULL || res == -ECANCELED) {
+      continue;
+    }
+
+    // the poll was busy with an event, it keeps the old events till the update is retried
+    if (update) {
+      if (res == -EALREADY && object->events != 0 && uring_disarm(reactor, object, object->events) == -1) {
+        return -1;
+      }
+      continue;
+    }
+
+    // multishot poll was terminated by kernel, re-arm it
+    if (!more && object->events != 0) {
+      if (uring_arm(reactor, object, object->events) == -1) {
+        return -1;
+      }
+    }
+
+    if (res < 0) {
+      continue;
+    }
+
+    // multishot poll could post several completions for the same object,
+    // merge them as epoll reports an object at most once per wait
+    bool merged = false;
+    for (int i = 0; i < n; ++i) {
+      if (events[i].object == object) {
+        events[i].events |= to_reactor((unsigned)res);
+        merged = true;
+        break;
+      }
+    }
+
+    if (!merged) {
+      events[n].events = to_reactor((unsigned)res);
+      events[n].object = object;
+      n++;
+    }
+  }
+
+  return n;
+}
+
+// Objects without fd are virtual: the backend does not know about them,
+// so they only get events passed to reactor_defer()
+static bool is_virtual(Evented* object) {
+  return object->fd == -1;
+}
+
+int reactor_register(Reactor* reactor, Evented* object, unsigned events) {
+  object->ready = 0;
+  object->ready_prev = NULL;
+  object->ready_next = NULL;
+  if (is_virtual(object)) {
+    object->events = events;
+    return 0;
+  }
+
+  int status = -1;
+  switch (reactor->backend) {
+    case REACTOR_BACKEND_EPOLL:
+      status = epoll_register(reactor, object, events);
+      break;
+    case REACTOR_BACKEND_IO_URING:
+      status = uring_register(reactor, object, events);
+      break;
+  }
+
+  if (status == -1) {
     return -1;
   }
 
@@ -74,10 +356,22 @@ int reactor_update(Reactor* reactor, Evented* object, unsigned events) {
     return 0;
   }
 
-  struct epoll_event event;
-  event.events = to_epoll(events);
-  event.data.ptr = object;
-  if (epoll_ctl(reactor->poll, EPOLL_CTL_MOD, object->fd, &event) == -1) {
+  if (is_virtual(object)) {
+    object->events = events;
+    return 0;
+  }
+
+  int status = -1;
+  switch (reactor->backend) {
+    case REACTOR_BACKEND_EPOLL:
+      status = epoll_update(reactor, object, events);
+      break;
+    case REACTOR_BACKEND_IO_URING:
+      status = uring_update(reactor, object, events);
+      break;
+  }
+
+  if (status == -1) {
     return -1;
   }
 
@@ -85,27 +379,327 @@ int reactor_update(Reactor* reactor, Evented* object, unsigned events) {
   return 0;
 }
 
+static void reactor_unready(Reactor* reactor, Evented* object);
+
 int reactor_deregister(Reactor* reactor, Evented* object) {
-  return epoll_ctl(reactor->poll, EPOLL_CTL_DEL, object->fd, NULL);
+  // the object could still have events in the batch which is being dispatched
+  object->handler = NULL;
+  reactor_unready(reactor, object);
+  if (is_virtual(object)) {
+    return 0;
+  }
+
+  switch (reactor->backend) {
+    case REACTOR_BACKEND_EPOLL:
+      return epoll_deregister(reactor, object);
+    case REACTOR_BACKEND_IO_URING:
+      return uring_deregister(reactor, object);
+  }
+
+  return -1;
+}
+
+void reactor_schedule(Reactor* reactor, Timer* timer, int delay_ms) {
+  timer_wheel_add(&reactor->timers, timer, clock_now_ms() + delay_ms);
+}
+
+void reactor_cancel(Reactor* reactor, Timer* timer) {
+  timer_wheel_remove(&reactor->timers, timer);
+}
+
+void reactor_defer(Reactor* reactor, Evented* object, unsigned events) {
+  if (object->ready != 0) {
+    object->ready |= events;
+    return;
+  }
+
+  object->ready = events;
+  object->ready_prev = reactor->ready_tail;
+  object->ready_next = NULL;
+  if (reactor->ready_tail != NULL) {
+    reactor->ready_tail->ready_next = object;
+  }
+  else {
+    reactor->ready_head = object;
+  }
+  reactor->ready_tail = object;
+}
+
+static void reactor_unready(Reactor* reactor, Evented* object) {
+  if (object->ready == 0) {
+    return;
+  }
+
+  if (object->ready_prev != NULL) {
+    object->ready_prev->ready_next = object->ready_next;
+  }
+  else {
+    reactor->ready_head = object->ready_next;
+  }
+
+  if (object->ready_next != NULL) {
+    object->ready_next->ready_prev = object->ready_prev;
+  }
+  else {
+    reactor->ready_tail = object->ready_prev;
+  }
+
+  object->ready = 0;
+  object->ready_prev = NULL;
+  object->ready_next = NULL;
 }
 
+// Add deferred events to |n| events reported by the backend
+// returns: new number of events
+static int reactor_take_ready(Reactor* reactor, IOEvent* events, int n, int n_events) {
+  if (reactor->ready_head == NULL) {
+    return n;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    Evented* object = events[i].object;
+    if (object->ready != 0) {
+      events[i].events |= object->ready;
+      reactor_unready(reactor, object);
+    }
+  }
+
+  // the rest stays queued if it does not fit
+  while (n < n_events && reactor->ready_head != NULL) {
+    Evented* object = reactor->ready_head;
+    events[n].object = object;
+    events[n].events = object->ready;
+    reactor_unready(reactor, object);
+    n++;
+  }
+
+  return n;
+}
+
+// Shorten |timeout_ms| so the wait ends when the next timer is due
+static int reactor_timeout(Reactor* reactor, int timeout_ms) {
+  uint64_t next = timer_wheel_next(&reactor->timers);
+  if (next == UINT64_MAX) {
+    return timeout_ms;
+  }
+
+  uint64_t now = reactor->timers.now;
+  uint64_t delay = next > now ? next - now : 0;
+  if (timeout_ms < 0 || delay < (uint64_t)timeout_ms) {
+    return (int)delay;
+  }
+
+  return timeout_ms;
+}
+
+// Posted tasks
+//
+// Intrusive MPSC queue by Dmitry Vyukov: push is a single atomic exchange,
+// pop is wait-free, but could spuriously return NULL while a producer is in
+// the middle of push (such producer wakes the reactor once it's done).
+
+static void reactor_push_task(Reactor* reactor, ReactorTask* task) {
+  atomic_store(&task->next, NULL);
+  ReactorTask* prev = atomic_exchange(&reactor->tasks_head, task);
+  atomic_store(&prev->next, task);
+}
+
+static ReactorTask* reactor_pop_task(Reactor* reactor) {
+  ReactorTask* tail = reactor->tasks_tail;
+  ReactorTask* next = atomic_load(&tail->next);
+  if (tail == &reactor->tasks_stub) {
+    if (next == NULL) {
+      return NULL;
+    }
+
+    reactor->tasks_tail = next;
+    tail = next;
+    next = atomic_load(&next->next);
+  }
+
+  if (next != NULL) {
+    reactor->tasks_tail = next;
+    return tail;
+  }
+
+  if (tail != atomic_load(&reactor->tasks_head)) {
+    // producer has not linked its task yet
+    return NULL;
+  }
+
+  // |tail| is the last task, put stub behind it so it can be popped
+  reactor_push_task(reactor, &reactor->tasks_stub);
+  next = atomic_load(&tail->next);
+  if (next != NULL) {
+    reactor->tasks_tail = next;
+    return tail;
+  }
+
+  return NULL;
+}
+
+static int reactor_init_wakeup(Reactor* reactor) {
+  atomic_store(&reactor->tasks_stub.next, NULL);
+  atomic_store(&reactor->tasks_head, &reactor->tasks_stub);
+  reactor->tasks_tail = &reactor->tasks_stub;
+  atomic_store(&reactor->wakeup_pending, false);
+
+  reactor->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (reactor->wakeup.fd == -1) {
+    return -1;
+  }
+
+  reactor->wakeup.events = 0;
+  evented_set_handler(&reactor->wakeup, NULL, NULL);
+  evented_set_stats(&reactor->wakeup, NULL);
+  return reactor_register(reactor, &reactor->wakeup, IO_EVENT_READ);
+}
+
+static void reactor_discard_tasks(Reactor* reactor) {
+  ReactorTask* task = NULL;
+  while ((task = reactor_pop_task(reactor)) != NULL) {
+    free(task);
+  }
+}
+
+void reactor_run_tasks(Reactor* reactor) {
+  // must be reset before popping, so producers that push after this point signal again
+  atomic_store(&reactor->wakeup_pending, false);
+
+  ReactorTask* task = NULL;
+  while ((task = reactor_pop_task(reactor)) != NULL) {
+    TaskCallback callback = task->callback;
+    void* context = task->context;
+    free(task);
+    callback(context);
+  }
+}
+
+// Remove wakeup notification from |events|
+// returns: new number of events
+static int reactor_filter_wakeup(Reactor* reactor, IOEvent* events, int n) {
+  for (int i = 0; i < n; ++i) {
+    if (events[i].object != &reactor->wakeup) {
+      continue;
+    }
+
+    uint64_t value = 0;
+    if (read(reactor->wakeup.fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+      return -1;
+    }
+
+    events[i] = events[n - 1];
+    return n - 1;
+  }
+
+  return n;
+}
+
+int reactor_post(Reactor* reactor, TaskCallback callback, void* context) {
+  ReactorTask* task = malloc(sizeof(ReactorTask));
+  if (task == NULL) {
+    return -1;
+  }
+
+  task->callback = callback;
+  task->context = context;
+  reactor_push_task(reactor, task);
+  reactor_wake(reactor);
+  return 0;
+}
+
+void reactor_wake(Reactor* reactor) {
+  if (!atomic_exchange(&reactor->wakeup_pending, true)) {
+    uint64_t one = 1;
+    // can only fail if the counter overflows, the reactor is woken up anyway then
+    ssize_t n = write(reactor->wakeup.fd, &one, sizeof(one));
+    (void)n;
+  }
+}
+
+// Run expired timers and posted tasks
+static void reactor_run_pending(Reactor* reactor) {
+  timer_wheel_advance(&reactor->timers, clock_now_ms());
+  reactor_run_tasks(reactor);
+}
+
+uint64_t reactor_syscalls(Reactor* reactor) {
+  return reactor->backend == REACTOR_BACKEND_EPOLL ? reactor->stats.epoll_calls : reactor->ring.enters;
+}
 
 int reactor_poll(Reactor* reactor, IOEvent* events, int n_events, int timeout_ms) {
-  static const int MAX_EVENTS = 64;
-  struct epoll_event epoll_events[MAX_EVENTS];
-  // TODO: handle this case properly
-  if (n_events > MAX_EVENTS) {
-    n_events = MAX_EVENTS;
+  reactor_run_pending(reactor);
+  timeout_ms = reactor_timeout(reactor, timeout_ms);
+  if (reactor->ready_head != NULL) {
+    timeout_ms = 0;
   }
 
-  int n = epoll_wait(reactor->poll, epoll_events, n_events, timeout_ms);
+  uint64_t wait_start = clock_now_ns();
+  int n = -1;
+  switch (reactor->backend) {
+    case REACTOR_BACKEND_EPOLL:
+      n = epoll_poll(reactor, events, n_events, timeout_ms);
+      break;
+    case REACTOR_BACKEND_IO_URING:
+      n = uring_poll(reactor, events, n_events, timeout_ms);
+      break;
+  }
+
+  histogram_add(&reactor->stats.wait_ns, clock_now_ns() - wait_start);
+
+  if (n > 0) {
+    n = reactor_filter_wakeup(reactor, events, n);
+  }
+
+  if (n >= 0) {
+    n = reactor_take_ready(reactor, events, n, n_events);
+  }
+
+  if (n >= 0) {
+    histogram_add(&reactor->stats.events_per_wake, n);
+  }
+
+  if (n == 0) {
+    reactor_run_pending(reactor);
+  }
+
+  return n;
+}
+
+void evented_set_handler(Evented* object, EventHandler handler, void* context) {
+  object->handler = handler;
+  object->context = context;
+}
+
+void evented_set_stats(Evented* object, Histogram* handler_ns) {
+  object->handler_ns = handler_ns;
+}
+
+int reactor_dispatch(Reactor* reactor, int timeout_ms) {
+  static const int MAX_EVENTS = 64;
+  IOEvent events[MAX_EVENTS];
+
+  int n = reactor_poll(reactor, events, MAX_EVENTS, timeout_ms);
   if (n == -1) {
     return -1;
   }
 
   for (int i = 0; i < n; ++i) {
-    events[i].events = to_reactor(epoll_events[i].events);
-    events[i].object = epoll_events[i].data.ptr;
+    Evented* object = events[i].object;
+    if (object->handler == NULL) {
+      continue;
+    }
+
+    // the handler could release |object|
+    Histogram* handler_ns = object->handler_ns;
+    uint64_t start = handler_ns != NULL ? clock_now_ns() : 0;
+    if (object->handler(object->context, events[i].events) == -1) {
+      return -1;
+    }
+
+    if (handler_ns != NULL) {
+      histogram_add(handler_ns, clock_now_ns() - start);
+    }
   }
 
   return n;
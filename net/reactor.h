@@ -1,21 +1,93 @@
 #ifndef REACTOR_H
 #define REACTOR_H
 
+#include <stdatomic.h>
+
+#include "uring.h"
+#include "timer.h"
+#include "histogram.h"
+
 enum {
   IO_EVENT_READ  = (1 << 0),
   IO_EVENT_WRITE = (1 << 1),
 };
 
-typedef struct Reactor {
-  int poll;
-} Reactor;
+typedef enum {
+  // epoll(7), one epoll_ctl() per subscription change
+  REACTOR_BACKEND_EPOLL,
+  // io_uring(7), subscription changes are batched and submitted
+  // together with the wait in a single io_uring_enter() per reactor_poll()
+  // Only readiness comes from the ring, streams still read and write with syscalls of their own:
+  // a stream gives its blocks back to the pool as soon as they're empty and moves between workers
+  // and processes, so the kernel can't hold on to them for an operation in flight
+  REACTOR_BACKEND_IO_URING,
+} ReactorBackend;
+
+typedef void (*TaskCallback)(void* context);
 
+// Task posted to the reactor from another thread
+typedef struct ReactorTask {
+  _Atomic(struct ReactorTask*) next;
+  TaskCallback callback;
+  void* context;
+} ReactorTask;
+
+// Handler of events triggered for IO object
+// returns: -1 on fatal error, which stops reactor_dispatch(), 0 otherwise
+typedef int (*EventHandler)(void* context, unsigned events);
 
 typedef struct Evented {
+  // -1 for a virtual object, which gets only events passed to reactor_defer()
   int fd;
   unsigned events;
+  // Called by reactor_dispatch(), reset by reactor_deregister()
+  EventHandler handler;
+  void* context;
+  // Run time of |handler| in ns, not collected if NULL
+  Histogram* handler_ns;
+  // Events to be reported again by the next reactor_poll(), see reactor_defer()
+  unsigned ready;
+  struct Evented* ready_prev;
+  struct Evented* ready_next;
 } Evented;
 
+// Reactor loop instrumentation, always on: it costs two vDSO clock reads per wait and per timed handler
+typedef struct ReactorStats {
+  // Number of IO events returned by every wait
+  Histogram events_per_wake;
+  // Time spent in every wait, ns
+  Histogram wait_ns;
+  // epoll_wait() and epoll_ctl() calls, the ring counts io_uring_enter() calls itself, see reactor_syscalls()
+  uint64_t epoll_calls;
+} ReactorStats;
+
+typedef struct Reactor {
+  ReactorBackend backend;
+  // REACTOR_BACKEND_EPOLL
+  int poll;
+  // REACTOR_BACKEND_IO_URING
+  Uring ring;
+  // Timers, they drive the timeout of reactor_poll()
+  TimerWheel timers;
+  // Objects with deferred events in FIFO order
+  Evented* ready_head;
+  Evented* ready_tail;
+
+  // Lock-free multi-producer single-consumer queue of posted tasks
+  // Producers push to |tasks_head|, the reactor thread pops from |tasks_tail|
+  _Atomic(ReactorTask*) tasks_head;
+  ReactorTask* tasks_tail;
+  ReactorTask tasks_stub;
+  // eventfd which wakes up the reactor thread
+  Evented wakeup;
+  // Set if wakeup is already signaled, but not handled yet
+  atomic_bool wakeup_pending;
+
+  // Owned by the reactor thread, read it from there as well
+  ReactorStats stats;
+} Reactor;
+
+
 typedef struct IOEvent {
   // A set of events
   unsigned events;
@@ -23,7 +95,10 @@ typedef struct IOEvent {
   Evented* object;
 } IOEvent;
 
+// Initialize reactor with the default (epoll) backend
 int reactor_init(Reactor* reactor);
+// Initialize reactor with specified |backend|
+int reactor_init_backend(Reactor* reactor, ReactorBackend backend);
 void reactor_close(Reactor* reactor);
 
 // Add IO |object| to |reactor| and subscribe it to |events|
@@ -33,7 +108,44 @@ int reactor_update(Reactor* reactor, Evented* object, unsigned events);
 // Remove IO |object| from |reactor|
 int reactor_deregister(Reactor* reactor, Evented* object);
 
+// Schedule |timer| to fire in |delay_ms|, reschedules already pending timer
+// Callbacks are called from reactor_poll() before waiting for IO or when
+// the wait ended without IO events, so they never invalidate returned events
+void reactor_schedule(Reactor* reactor, Timer* timer, int delay_ms);
+// Cancel pending |timer|, does nothing if it is not pending
+void reactor_cancel(Reactor* reactor, Timer* timer);
+
+// Report |events| of |object| again by the next reactor_poll() without waiting for the OS
+// Edge-triggered backends don't repeat an event, so this is the way to leave work for later
+// Deferred events are merged with the events reported by the backend, reactor_deregister() drops them
+void reactor_defer(Reactor* reactor, Evented* object, unsigned events);
+
+// Run |callback| with |context| on the reactor thread, could be called from any thread
+// Callbacks are called from reactor_poll(), the same way as timers are
+// Tasks which are still pending on reactor_close() are discarded
+int reactor_post(Reactor* reactor, TaskCallback callback, void* context);
+// Run posted tasks right away, reactor_poll() does it automatically
+void reactor_run_tasks(Reactor* reactor);
+// Interrupt reactor_poll() waiting on another thread
+// Async-signal-safe
+void reactor_wake(Reactor* reactor);
+
+// returns: syscalls made by the backend so far, epoll_wait() and epoll_ctl() or io_uring_enter()
+// Reads and writes of the objects are not counted
+uint64_t reactor_syscalls(Reactor* reactor);
+
 // Poll |reactor| for |events|
+// The wait is shortened if a timer is due before |timeout_ms| expires
 int reactor_poll(Reactor* reactor, IOEvent* events, int n_events, int timeout_ms);
 
+// Set |handler| to be called with |context| for events of |object|
+void evented_set_handler(Evented* object, EventHandler handler, void* context);
+
+// Collect run time of |object| handler into |handler_ns|, could be shared by many objects
+void evented_set_stats(Evented* object, Histogram* handler_ns);
+
+// Poll |reactor| and call the handler of every object with triggered events
+// returns: -1 on error (reactor_poll() or handler failure), number of dispatched events otherwise
+int reactor_dispatch(Reactor* reactor, int timeout_ms);
+
 #endif // REACTOR_H
@@ -0,0 +1,167 @@
+#include "ring_buffer.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+int ring_buffer_init(RingBuffer* buffer, int capacity, int max_capacity) {
+  buffer->data = malloc(capacity);
+  if (buffer->data == NULL) {
+    return -1;
+  }
+
+  buffer->capacity = capacity;
+  buffer->max_capacity = max_capacity;
+  buffer->head = 0;
+  buffer->size = 0;
+  return 0;
+}
+
+void ring_buffer_free(RingBuffer* buffer) {
+  free(buffer->data);
+  buffer->data = NULL;
+}
+
+void ring_buffer_init_detached(RingBuffer* buffer, int max_capacity) {
+  buffer->data = NULL;
+  buffer->capacity = 0;
+  buffer->max_capacity = max_capacity;
+  buffer->head = 0;
+  buffer->size = 0;
+}
+
+void ring_buffer_attach(RingBuffer* buffer, char* data, int capacity) {
+  buffer->data = data;
+  buffer->capacity = capacity;
+  buffer->head = 0;
+  buffer->size = 0;
+}
+
+char* ring_buffer_detach(RingBuffer* buffer) {
+  char* data = buffer->data;
+  ring_buffer_init_detached(buffer, buffer->max_capacity);
+  return data;
+}
+
+// Copy |n| bytes starting at |offset| from the head out of |buffer|
+static void ring_buffer_copy_out(const RingBuffer* buffer, int offset, char* destination, int n) {
+  int start = (buffer->head + offset) & (buffer->capacity - 1);
+  int first = buffer->capacity - start < n ? buffer->capacity - start : n;
+  memcpy(destination, buffer->data + start, first);
+  memcpy(destination + first, buffer->data, n - first);
+}
+
+// Move stored data to a new allocation of |capacity| bytes, starting at offset 0
+static int ring_buffer_realloc(RingBuffer* buffer, int capacity) {
+  char* data = malloc(capacity);
+  if (data == NULL) {
+    return -1;
+  }
+
+  ring_buffer_copy_out(buffer, 0, data, buffer->size);
+  free(buffer->data);
+  buffer->data = data;
+  buffer->capacity = capacity;
+  buffer->head = 0;
+  return 0;
+}
+
+int ring_buffer_reserve(RingBuffer* buffer, int n) {
+  if (ring_buffer_space(buffer) >= n) {
+    return 0;
+  }
+
+  int capacity = buffer->capacity > 0 ? buffer->capacity : 1;
+  while (capacity - buffer->size < n) {
+    capacity *= 2;
+  }
+
+  if (capacity > buffer->max_capacity) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  // growing is rare, so it's fine to straighten the data here
+  return ring_buffer_realloc(buffer, capacity);
+}
+
+char* ring_buffer_contiguous_space(RingBuffer* buffer, int n) {
+  int end = buffer->head + buffer->size;
+  if (end < buffer->capacity) {
+    return buffer->capacity - end >= n ? buffer->data + end : NULL;
+  }
+
+  return buffer->head - (end - buffer->capacity) >= n ? buffer->data + end - buffer->capacity : NULL;
+}
+
+int ring_buffer_write(RingBuffer* buffer, const char* data, int n) {
+  if (ring_buffer_reserve(buffer, n) == -1) {
+    return -1;
+  }
+
+  int tail = (buffer->head + buffer->size) & (buffer->capacity - 1);
+  int first = buffer->capacity - tail < n ? buffer->capacity - tail : n;
+  memcpy(buffer->data + tail, data, first);
+  memcpy(buffer->data, data + first, n - first);
+  buffer->size += n;
+  return 0;
+}
+
+void ring_buffer_read(RingBuffer* buffer, char* destination, int n) {
+  ring_buffer_copy_out(buffer, 0, destination, n);
+  ring_buffer_consume(buffer, n);
+}
+
+void ring_buffer_consume(RingBuffer* buffer, int n) {
+  buffer->size -= n;
+  // an empty buffer starts over, so small messages don't wrap
+  buffer->head = buffer->size == 0 ? 0 : (buffer->head + n) & (buffer->capacity - 1);
+}
+
+void ring_buffer_commit(RingBuffer* buffer, int n) {
+  buffer->size += n;
+}
+
+int ring_buffer_data_iov(const RingBuffer* buffer, struct iovec iov[2]) {
+  if (buffer->size == 0) {
+    return 0;
+  }
+
+  int first = buffer->capacity - buffer->head;
+  if (first >= buffer->size) {
+    iov[0] = (struct iovec){.iov_base = buffer->data + buffer->head, .iov_len = buffer->size};
+    return 1;
+  }
+
+  iov[0] = (struct iovec){.iov_base = buffer->data + buffer->head, .iov_len = first};
+  iov[1] = (struct iovec){.iov_base = buffer->data, .iov_len = buffer->size - first};
+  return 2;
+}
+
+int ring_buffer_space_iov(const RingBuffer* buffer, struct iovec iov[2]) {
+  int space = ring_buffer_space(buffer);
+  if (space == 0) {
+    return 0;
+  }
+
+  int tail = (buffer->head + buffer->size) & (buffer->capacity - 1);
+  int first = buffer->capacity - tail;
+  if (first >= space) {
+    iov[0] = (struct iovec){.iov_base = buffer->data + tail, .iov_len = space};
+    return 1;
+  }
+
+  iov[0] = (struct iovec){.iov_base = buffer->data + tail, .iov_len = first};
+  iov[1] = (struct iovec){.iov_base = buffer->data, .iov_len = space - first};
+  return 2;
+}
+
+const char* ring_buffer_peek(const RingBuffer* buffer, int n, char* scratch) {
+  if (buffer->head + n <= buffer->capacity) {
+    return buffer->data + buffer->head;
+  }
+
+  ring_buffer_copy_out(buffer, 0, scratch, n);
+  return scratch;
+}
@@ -0,0 +1,72 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <sys/uio.h>
+
+// Byte queue over a circular buffer, which grows on demand up to |max_capacity|
+// Data is never moved on consume, readv()/writev() work across the wrap point
+typedef struct RingBuffer {
+  char* data;
+  // Power of two
+  int capacity;
+  int max_capacity;
+  // Offset of the first stored byte and number of stored bytes
+  int head;
+  int size;
+} RingBuffer;
+
+int ring_buffer_init(RingBuffer* buffer, int capacity, int max_capacity);
+void ring_buffer_free(RingBuffer* buffer);
+
+// Init |buffer| without memory, it has no space until ring_buffer_attach() or ring_buffer_reserve()
+void ring_buffer_init_detached(RingBuffer* buffer, int max_capacity);
+
+// Give empty detached |buffer| |capacity| bytes of |data|, |capacity| is a power of two
+void ring_buffer_attach(RingBuffer* buffer, char* data, int capacity);
+
+// Take memory away from |buffer| and drop its content
+// returns: the memory, NULL if |buffer| is detached already
+char* ring_buffer_detach(RingBuffer* buffer);
+
+static inline int ring_buffer_size(const RingBuffer* buffer) {
+  return buffer->size;
+}
+
+static inline int ring_buffer_space(const RingBuffer* buffer) {
+  return buffer->capacity - buffer->size;
+}
+
+// Grow |buffer| so at least |n| more bytes fit
+// returns: -1 if it would exceed max capacity or allocation failed, 0 otherwise
+int ring_buffer_reserve(RingBuffer* buffer, int n);
+
+// Find |n| bytes of free space right after the stored data, |buffer| neither grows nor moves data for them
+// returns: pointer to the space (see ring_buffer_commit()), NULL if the free space there is shorter,
+//          e.g. it's split by the wrap point, then ring_buffer_write() takes the bytes
+char* ring_buffer_contiguous_space(RingBuffer* buffer, int n);
+
+// Append |n| bytes of |data|, grows |buffer| if needed
+// returns: -1 if they don't fit, 0 otherwise
+int ring_buffer_write(RingBuffer* buffer, const char* data, int n);
+
+// Move |n| bytes from the front to |destination|
+void ring_buffer_read(RingBuffer* buffer, char* destination, int n);
+
+// Drop |n| bytes from the front
+void ring_buffer_consume(RingBuffer* buffer, int n);
+
+// Mark |n| bytes, which were written to the free space directly, as stored
+void ring_buffer_commit(RingBuffer* buffer, int n);
+
+// Describe stored bytes as at most 2 segments
+// returns: number of segments
+int ring_buffer_data_iov(const RingBuffer* buffer, struct iovec iov[2]);
+
+// Describe free space as at most 2 segments
+// returns: number of segments
+int ring_buffer_space_iov(const RingBuffer* buffer, struct iovec iov[2]);
+
+// returns: pointer to the first |n| stored bytes, they are copied to |scratch| if they wrap around
+const char* ring_buffer_peek(const RingBuffer* buffer, int n, char* scratch);
+
+#endif // RING_BUFFER_H
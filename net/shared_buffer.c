@@ -0,0 +1,26 @@
+#include "shared_buffer.h"
+
+#include <stdlib.h>
+
+
+SharedBuffer* shared_buffer_create(int capacity) {
+  SharedBuffer* buffer = malloc(sizeof(SharedBuffer) + capacity);
+  if (buffer == NULL) {
+    return NULL;
+  }
+
+  buffer->refs = 1;
+  buffer->size = 0;
+  return buffer;
+}
+
+SharedBuffer* shared_buffer_ref(SharedBuffer* buffer) {
+  buffer->refs++;
+  return buffer;
+}
+
+void shared_buffer_unref(SharedBuffer* buffer) {
+  if (--buffer->refs == 0) {
+    free(buffer);
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef SHARED_BUFFER_H
+#define SHARED_BUFFER_H
+
+// Immutable bytes referenced by output queues of many streams, e.g. a broadcast message which is serialized once
+// Reference counting is not atomic, a buffer is shared by streams of one reactor thread only
+typedef struct SharedBuffer {
+  int refs;
+  int size;
+  char data[];
+} SharedBuffer;
+
+// returns: a buffer of |capacity| bytes with a single reference and no data, NULL if out of memory
+SharedBuffer* shared_buffer_create(int capacity);
+
+// returns: |buffer| with one more reference
+SharedBuffer* shared_buffer_ref(SharedBuffer* buffer);
+
+// Drop a reference, the last one frees |buffer|
+void shared_buffer_unref(SharedBuffer* buffer);
+
+#endif // SHARED_BUFFER_H
@@ -0,0 +1,65 @@
+#include "transport.h"
+#include "tcp_stream.h"
+
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+static ssize_t socket_readv(TcpStream* stream, const struct iovec* iov, int iovcnt) {
+  return readv(stream->state.fd, iov, iovcnt);
+}
+
+static ssize_t socket_writev(TcpStream* stream, const struct iovec* iov, int iovcnt) {
+  // sendmsg() is writev() which takes MSG_NOSIGNAL
+  struct msghdr message = {.msg_iov = (struct iovec*)iov, .msg_iovlen = iovcnt};
+  return sendmsg(stream->state.fd, &message, MSG_NOSIGNAL);
+}
+
+static int socket_update(TcpStream* stream, unsigned events) {
+  return reactor_update(stream->reactor, &stream->state, events);
+}
+
+static void socket_shutdown(TcpStream* stream) {
+  reactor_deregister(stream->reactor, &stream->state);
+  shutdown(stream->state.fd, SHUT_RDWR);
+}
+
+static void socket_close(TcpStream* stream) {
+  reactor_deregister(stream->reactor, &stream->state);
+  close(stream->state.fd);
+}
+
+const TransportOps SOCKET_TRANSPORT = {
+  .name = "socket",
+  .readv = socket_readv,
+  .writev = socket_writev,
+  .update = socket_update,
+  .shutdown = socket_shutdown,
+  .close = socket_close,
+  .movable = true,
+};
+
+int tcp_socketpair(TcpStream* first, TcpStream* second, Reactor* reactor) {
+  int sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) == -1) {
+    return -1;
+  }
+
+  if (tcp_from_socket(first, reactor, sockets[0]) == -1) {
+    close(sockets[0]);
+    close(sockets[1]);
+    return -1;
+  }
+
+  if (tcp_from_socket(second, reactor, sockets[1]) == -1) {
+    int error = errno;
+    tcp_close(first);
+    close(sockets[1]);
+    errno = error;
+    return -1;
+  }
+
+  return 0;
+}
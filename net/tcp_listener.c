@@ -1,10 +1,13 @@
 #include "tcp_listener.h"
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
@@ -12,7 +15,8 @@
 #include "log.h"
 
 
-int tcp_listener_init(TcpListener* listener, Reactor* reactor, const char* ip, unsigned short port) {
+int tcp_listener_init(TcpListener* listener, Reactor* reactor, const char* ip, unsigned short port,
+                      int backlog, unsigned flags) {
   int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
   if (s == -1) {
     return -1;
@@ -24,6 +28,13 @@ int tcp_listener_init(TcpListener* listener, Reactor* reactor, const char* ip, u
     return -1;
   }
 
+  if (flags & TCP_LISTENER_REUSEPORT) {
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const void*)&flag, sizeof(int)) == -1) {
+      close(s);
+      return -1;
+    }
+  }
+
   struct sockaddr_in address;
   address.sin_family = AF_INET;
   address.sin_port = htons(port);
@@ -33,13 +44,24 @@ int tcp_listener_init(TcpListener* listener, Reactor* reactor, const char* ip, u
     return -1;
   }
 
-  if (listen(s, 16) == -1) {
+  if (listen(s, backlog) == -1) {
+    close(s);
+    return -1;
+  }
+
+  if (tcp_listener_from_socket(listener, reactor, s) == -1) {
     close(s);
     return -1;
   }
 
+  return 0;
+}
+
+int tcp_listener_from_socket(TcpListener* listener, Reactor* reactor, int s) {
   listener->state.fd = s;
   listener->state.events = 0;
+  evented_set_handler(&listener->state, NULL, NULL);
+  evented_set_stats(&listener->state, NULL);
   listener->reactor = reactor;
   return reactor_register(listener->reactor, &listener->state, 0);
 }
@@ -68,8 +90,68 @@ int tcp_listener_accept(TcpListener* listener, TcpStream* accepted, struct socka
   }
 
   if (tcp_from_socket(accepted, listener->reactor, socket) == -1) {
+    close(socket);
     return -1;
   }
 
   return 1;
 }
+
+int tcp_listener_get_info(TcpListener* listener, TcpListenerInfo* info) {
+  // for a listening socket tcpi_unacked is the accept queue length and tcpi_sacked is its limit
+  struct tcp_info tcp;
+  socklen_t size = sizeof(tcp);
+  if (getsockopt(listener->state.fd, IPPROTO_TCP, TCP_INFO, &tcp, &size) == -1) {
+    return -1;
+  }
+
+  info->queued = tcp.tcpi_unacked;
+  info->backlog = tcp.tcpi_sacked;
+  return 0;
+}
+
+int tcp_listen_overflows(uint64_t* overflows, uint64_t* drops) {
+  FILE* file = fopen("/proc/net/netstat", "r");
+  if (file == NULL) {
+    return -1;
+  }
+
+  // counters come in pairs of lines: "TcpExt: Name1 Name2 ..." and "TcpExt: value1 value2 ..."
+  char* names = NULL;
+  char* values = NULL;
+  size_t names_size = 0;
+  size_t values_size = 0;
+  int found = 0;
+  while (getline(&names, &names_size, file) != -1 && getline(&values, &values_size, file) != -1) {
+    if (strncmp(names, "TcpExt:", 7) != 0) {
+      continue;
+    }
+
+    char* names_state = NULL;
+    char* values_state = NULL;
+    char* name = strtok_r(names, " \n", &names_state);
+    char* value = strtok_r(values, " \n", &values_state);
+    while (name != NULL && value != NULL) {
+      if (strcmp(name, "ListenOverflows") == 0) {
+        *overflows = strtoull(value, NULL, 10);
+        found++;
+      }
+      else if (strcmp(name, "ListenDrops") == 0) {
+        *drops = strtoull(value, NULL, 10);
+        found++;
+      }
+      name = strtok_r(NULL, " \n", &names_state);
+      value = strtok_r(NULL, " \n", &values_state);
+    }
+    break;
+  }
+
+  free(names);
+  free(values);
+  fclose(file);
+  if (found != 2) {
+    errno = ENOENT;
+    return -1;
+  }
+  return 0;
+}
@@ -1,18 +1,39 @@
 #ifndef TCP_LISTENER_H
 #define TCP_LISTENER_H
 
+#include <stdint.h>
+
 #include "reactor.h"
 
 typedef struct TcpStream TcpStream;
 struct sockaddr_in;
 
+enum {
+  // Allow several listeners to bind the same address (SO_REUSEPORT),
+  // incoming connections are distributed between them by the kernel
+  TCP_LISTENER_REUSEPORT = (1 << 0),
+};
+
 typedef struct TcpListener {
   Evented state;
   Reactor* reactor;
 } TcpListener;
 
+// Accept queue of a listener (TCP_INFO of a listening socket)
+typedef struct {
+  // Connections waiting for accept() and the limit, the kernel drops SYNs beyond it
+  uint32_t queued;
+  uint32_t backlog;
+} TcpListenerInfo;
+
 // Initialize tcp listener
-int tcp_listener_init(TcpListener* listener, Reactor* reactor, const char* ip, unsigned short port);
+// |backlog| is the length of the accept queue, the kernel caps it at net.core.somaxconn
+// |flags| is a set of TCP_LISTENER_* flags
+int tcp_listener_init(TcpListener* listener, Reactor* reactor, const char* ip, unsigned short port,
+                      int backlog, unsigned flags);
+
+// Initialize tcp listener from a listening socket, e.g. one inherited from another process
+int tcp_listener_from_socket(TcpListener* listener, Reactor* reactor, int socket);
 
 void tcp_listener_close(TcpListener* listener);
 
@@ -28,4 +49,10 @@ int tcp_listener_stop_accept(TcpListener* listener);
 //  1  on success and |stream| is initialized with accepted client
 int tcp_listener_accept(TcpListener* listener, TcpStream* stream, struct sockaddr_in* address);
 
+int tcp_listener_get_info(TcpListener* listener, TcpListenerInfo* info);
+
+// Read ListenOverflows and ListenDrops counters of the network namespace from /proc/net/netstat,
+// the kernel doesn't count them per socket
+int tcp_listen_overflows(uint64_t* overflows, uint64_t* drops);
+
 #endif // TCP_LISTENER_H
@@ -1,14 +1,28 @@
 #include "tcp_stream.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
+#include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#include "clock.h"
+
+// Linux 5.11+, not exposed by older headers
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
 
 int tcp_init(TcpStream* stream, Reactor* loop) {
   int s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
@@ -16,29 +30,267 @@ int tcp_init(TcpStream* stream, Reactor* loop) {
     return -1;
   }
 
-  return tcp_from_socket(stream, loop, s);
+  if (tcp_from_socket(stream, loop, s) == -1) {
+    close(s);
+    return -1;
+  }
+
+  return 0;
 }
 
 int tcp_from_socket(TcpStream* stream, Reactor* reactor, int socket) {
-  stream->state.fd = socket;
+  return tcp_from_transport(stream, reactor, socket, &SOCKET_TRANSPORT, NULL);
+}
+
+int tcp_from_transport(TcpStream* stream, Reactor* reactor, int fd, const TransportOps* transport, void* data) {
+  stream->state.fd = fd;
   stream->state.events = 0;
+  evented_set_handler(&stream->state, NULL, NULL);
+  evented_set_stats(&stream->state, NULL);
   stream->reactor = reactor;
-  stream->received = 0;
-  stream->to_send = 0;
+  stream->flags = 0;
+  stream->transport = transport;
+  stream->transport_data = data;
+  stream->sent_bytes = 0;
+  stream->rx_ns = 0;
+  stream->tx_ns = 0;
+  stream->tx_bytes = 0;
+  // buffers get memory on first use
+  stream->buffers = NULL;
+  ring_buffer_init_detached(&stream->input, NET_BUFFER_MAX_SIZE);
+  ring_buffer_init_detached(&stream->output, NET_BUFFER_MAX_SIZE);
   return reactor_register(reactor, &stream->state, 0);
 }
 
+// Give |buffer| a block before it's written to
+static int tcp_attach_buffer(TcpStream* stream, RingBuffer* buffer) {
+  if (buffer->data != NULL) {
+    return 0;
+  }
+
+  char* data = stream->buffers != NULL ? buffer_pool_acquire(stream->buffers) : malloc(NET_BUFFER_SIZE);
+  if (data == NULL) {
+    return -1;
+  }
+
+  ring_buffer_attach(buffer, data, NET_BUFFER_SIZE);
+  return 0;
+}
+
+static void tcp_release_buffer(TcpStream* stream, RingBuffer* buffer) {
+  int capacity = buffer->capacity;
+  char* data = ring_buffer_detach(buffer);
+  // a grown buffer is not a block of the pool
+  if (stream->buffers != NULL && data != NULL && capacity == stream->buffers->block_size) {
+    buffer_pool_release(stream->buffers, data);
+  }
+  else {
+    free(data);
+  }
+}
+
+// Return the block of |buffer| to the pool once it's empty, streams without a pool keep it
+static void tcp_trim_buffer(TcpStream* stream, RingBuffer* buffer) {
+  if (stream->buffers != NULL && buffer->data != NULL && ring_buffer_size(buffer) == 0) {
+    tcp_release_buffer(stream, buffer);
+  }
+}
+
+// Append |size| bytes of |data| to the output buffer
+// returns: -1 if they don't fit, 0 otherwise
+static int tcp_buffer_output(TcpStream* stream, const char* data, int size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  if (tcp_attach_buffer(stream, &stream->output) == -1) {
+    return -1;
+  }
+
+  return ring_buffer_write(&stream->output, data, size);
+}
+
 void tcp_close(TcpStream* stream) {
-  reactor_deregister(stream->reactor, &stream->state);
-  close(stream->state.fd);
+  stream->transport->close(stream);
+  tcp_release_buffer(stream, &stream->input);
+  tcp_release_buffer(stream, &stream->output);
 }
 
 void tcp_shutdown(TcpStream* stream) {
-  reactor_deregister(stream->reactor, &stream->state);
-  shutdown(stream->state.fd, SHUT_RDWR);
+  stream->transport->shutdown(stream);
+}
+
+int tcp_set_eager_send(TcpStream* stream) {
+  stream->flags |= TCP_EAGER_SEND;
+  return stream->transport->update(stream, stream->state.events | IO_EVENT_WRITE);
+}
+
+void tcp_set_buffer_pool(TcpStream* stream, BufferPool* pool) {
+  if (stream->buffers != pool) {
+    // blocks are separate allocations, so they are fine in any pool
+    tcp_trim_buffer(stream, &stream->input);
+    tcp_trim_buffer(stream, &stream->output);
+    stream->buffers = pool;
+  }
+}
+
+void tcp_set_max_buffer_size(TcpStream* stream, int input_size, int output_size) {
+  stream->input.max_capacity = input_size;
+  stream->output.max_capacity = output_size;
+}
+
+int tcp_set_busy_poll(TcpStream* stream, int usecs) {
+  if (stream->transport != &SOCKET_TRANSPORT) {
+    return 0;
+  }
+
+  if (setsockopt(stream->state.fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) == -1) {
+    return -1;
+  }
+
+  // makes the kernel defer softirq processing to our busy polling, older kernels reject it
+  int flag = 1;
+  if (setsockopt(stream->state.fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &flag, sizeof(flag)) == -1 && errno != ENOPROTOOPT) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int tcp_set_timestamping(TcpStream* stream) {
+  if (stream->transport != &SOCKET_TRANSPORT) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  // OPT_ID numbers transmit timestamps by the last byte of the send call, OPT_TSONLY omits the payload
+  int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+              SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+  if (setsockopt(stream->state.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+    return -1;
+  }
+
+  // the ids count from the moment the option is set
+  stream->sent_bytes = 0;
+  stream->tx_bytes = 0;
+  stream->flags |= TCP_TIMESTAMPING;
+  return 0;
+}
+
+// Kernel timestamps are CLOCK_REALTIME, the rest of the code measures CLOCK_MONOTONIC
+static uint64_t tcp_timestamp_ns(const struct timespec* timestamp) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t age = (int64_t)(now.tv_sec - timestamp->tv_sec) * 1000 * 1000 * 1000 + (now.tv_nsec - timestamp->tv_nsec);
+  return clock_now_ns() - age;
+}
+
+// returns: the software timestamp of a SCM_TIMESTAMPING message in |message|, NULL if there is none
+static const struct timespec* tcp_find_timestamp(struct msghdr* message) {
+  for (struct cmsghdr* c = CMSG_FIRSTHDR(message); c != NULL; c = CMSG_NXTHDR(message, c)) {
+    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+      const struct timespec* timestamp = &((const struct scm_timestamping*)CMSG_DATA(c))->ts[0];
+      return timestamp->tv_sec != 0 || timestamp->tv_nsec != 0 ? timestamp : NULL;
+    }
+  }
+  return NULL;
+}
+
+// Drain transmit timestamps from the error queue of |stream|
+static void tcp_collect_tx_timestamps(TcpStream* stream) {
+  while (true) {
+    char control[256];
+    struct msghdr message = {.msg_control = control, .msg_controllen = sizeof(control)};
+    if (recvmsg(stream->state.fd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      return;
+    }
+
+    const struct timespec* timestamp = tcp_find_timestamp(&message);
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&message); c != NULL; c = CMSG_NXTHDR(&message, c)) {
+      if (!((c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) ||
+            (c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR))) {
+        continue;
+      }
+
+      const struct sock_extended_err* error = (const struct sock_extended_err*)CMSG_DATA(c);
+      if (timestamp == NULL || error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING || error->ee_info != SCM_TSTAMP_SND) {
+        continue;
+      }
+
+      // the id is the offset of the last byte of the send call, truncated to 32 bits
+      uint32_t behind = (uint32_t)(stream->sent_bytes - 1) - error->ee_data;
+      uint64_t bytes = stream->sent_bytes - behind;
+      if (bytes > stream->tx_bytes) {
+        stream->tx_bytes = bytes;
+        stream->tx_ns = tcp_timestamp_ns(timestamp);
+      }
+    }
+  }
+}
+
+// readv() which records the arrival time of the data with TCP_TIMESTAMPING
+static ssize_t tcp_readv(TcpStream* stream, const struct iovec* iov, int iovcnt) {
+  if (!(stream->flags & TCP_TIMESTAMPING)) {
+    return stream->transport->readv(stream, iov, iovcnt);
+  }
+
+  char control[256];
+  struct msghdr message = {.msg_iov = (struct iovec*)iov, .msg_iovlen = iovcnt,
+                           .msg_control = control, .msg_controllen = sizeof(control)};
+  ssize_t n = recvmsg(stream->state.fd, &message, 0);
+  if (n > 0) {
+    const struct timespec* timestamp = tcp_find_timestamp(&message);
+    if (timestamp != NULL) {
+      stream->rx_ns = tcp_timestamp_ns(timestamp);
+    }
+  }
+  return n;
+}
+
+// writev() which counts bytes taken by the transport
+static ssize_t tcp_writev(TcpStream* stream, const struct iovec* iov, int iovcnt) {
+  ssize_t n = stream->transport->writev(stream, iov, iovcnt);
+  if (n > 0) {
+    stream->sent_bytes += n;
+  }
+  return n;
+}
+
+int tcp_get_info(TcpStream* stream, TcpInfo* info) {
+  if (stream->transport != &SOCKET_TRANSPORT) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  // AF_UNIX sockets fail here with EOPNOTSUPP as well
+  struct tcp_info tcp;
+  socklen_t size = sizeof(tcp);
+  if (getsockopt(stream->state.fd, IPPROTO_TCP, TCP_INFO, &tcp, &size) == -1) {
+    return -1;
+  }
+
+  // SIOCOUTQ counts unacknowledged and unsent bytes, SIOCOUTQNSD only unsent ones
+  int queued = 0;
+  int unsent = 0;
+  if (ioctl(stream->state.fd, SIOCOUTQ, &queued) == -1 || ioctl(stream->state.fd, SIOCOUTQNSD, &unsent) == -1) {
+    return -1;
+  }
+
+  info->rtt_us = tcp.tcpi_rtt;
+  info->rttvar_us = tcp.tcpi_rttvar;
+  info->retransmits = tcp.tcpi_total_retrans;
+  info->cwnd = tcp.tcpi_snd_cwnd;
+  info->unacked_bytes = queued - unsent;
+  info->unsent_bytes = unsent;
+  return 0;
 }
 
 int tcp_start_connect(TcpStream* stream, const char* ip, unsigned short port) {
+  // pairs are connected from the start, IO_EVENT_WRITE reports it as for a socket
+  if (stream->state.fd == -1) {
+    return stream->transport->update(stream, IO_EVENT_WRITE);
+  }
+
   struct sockaddr_in address;
   address.sin_family = AF_INET;
   address.sin_port = htons(port);
@@ -49,50 +301,145 @@ int tcp_start_connect(TcpStream* stream, const char* ip, unsigned short port) {
       return -1;
     }
   }
-  return reactor_update(stream->reactor, &stream->state, IO_EVENT_WRITE);
+  return stream->transport->update(stream, IO_EVENT_WRITE);
 }
 
 int tcp_connect(TcpStream* stream) {
   int error = 0;
   socklen_t error_len = sizeof(error);
-  if (getsockopt(stream->state.fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) {
+  if (stream->state.fd != -1 && getsockopt(stream->state.fd, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1) {
     return -1;
   }
-  reactor_update(stream->reactor, &stream->state, 0);
+  stream->transport->update(stream, 0);
   return error;
 }
 
+// Send as much of |data| as the socket takes right away
+// returns: -1 on error, number of sent bytes otherwise
+static int tcp_send_eagerly(TcpStream* stream, const char* data, int size) {
+  int total = 0;
+  while (total != size) {
+    struct iovec iov = {.iov_base = (char*)data + total, .iov_len = size - total};
+    int n = tcp_writev(stream, &iov, 1);
+    if (n == -1) {
+      if (errno == EWOULDBLOCK) {
+        break;
+      }
+      return -1;
+    }
+
+    total += n;
+  }
+
+  return total;
+}
+
 int tcp_start_send(TcpStream* stream, const char* data, int size) {
-  if (stream->to_send + size > sizeof(stream->output)) {
+  if (stream->flags & TCP_CORKED) {
+    return tcp_buffer_output(stream, data, size) == -1 ? 0 : size;
+  }
+
+  if (stream->flags & TCP_EAGER_SEND) {
+    // queued output has to go first, it's flushed on IO_EVENT_WRITE
+    int sent = 0;
+    if (ring_buffer_size(&stream->output) == 0) {
+      sent = tcp_send_eagerly(stream, data, size);
+      if (sent == -1) {
+        return -1;
+      }
+    }
+
+    if (tcp_buffer_output(stream, data + sent, size - sent) == -1) {
+      // the message is partially sent, a stream can't drop the rest
+      if (sent > 0) {
+        errno = ENOBUFS;
+        return -1;
+      }
+      return 0;
+    }
+
+    return size;
+  }
+
+  if (tcp_buffer_output(stream, data, size) == -1) {
     return 0;
   }
 
-  memcpy(stream->output + stream->to_send, data, size);
-  if (reactor_update(stream->reactor, &stream->state, stream->state.events | IO_EVENT_WRITE) == -1) {
+  if (stream->transport->update(stream, stream->state.events | IO_EVENT_WRITE) == -1) {
     return -1;
   }
 
-  stream->to_send += size;
   return size;
 }
 
+char* tcp_reserve(TcpStream* stream, int size) {
+  if (tcp_attach_buffer(stream, &stream->output) == -1) {
+    return NULL;
+  }
+
+  return ring_buffer_contiguous_space(&stream->output, size);
+}
+
+int tcp_commit(TcpStream* stream, int size) {
+  ring_buffer_commit(&stream->output, size);
+  if (stream->flags & TCP_CORKED) {
+    return 0;
+  }
+
+  if (stream->flags & TCP_EAGER_SEND) {
+    // queued output goes first, it's flushed on IO_EVENT_WRITE
+    return ring_buffer_size(&stream->output) == size ? tcp_send(stream) : 0;
+  }
+
+  return stream->transport->update(stream, stream->state.events | IO_EVENT_WRITE);
+}
+
+void tcp_cork(TcpStream* stream) {
+  stream->flags |= TCP_CORKED;
+}
+
+int tcp_uncork(TcpStream* stream) {
+  stream->flags &= ~TCP_CORKED;
+  if (ring_buffer_size(&stream->output) == 0) {
+    return 0;
+  }
+
+  if (tcp_send(stream) == -1) {
+    return -1;
+  }
+
+  if (ring_buffer_size(&stream->output) != 0 && !(stream->flags & TCP_EAGER_SEND)) {
+    return stream->transport->update(stream, stream->state.events | IO_EVENT_WRITE);
+  }
+
+  return 0;
+}
+
 int tcp_send(TcpStream* stream) {
+  if (stream->flags & TCP_CORKED) {
+    return 0;
+  }
+
+  if (stream->flags & TCP_TIMESTAMPING) {
+    tcp_collect_tx_timestamps(stream);
+  }
+
   bool success = true;
-  int total = 0;
-  while (total != stream->to_send) {
-    int n = send(stream->state.fd, stream->output + total, stream->to_send - total, MSG_NOSIGNAL);
+  while (ring_buffer_size(&stream->output) != 0) {
+    struct iovec iov[2];
+    int n = tcp_writev(stream, iov, ring_buffer_data_iov(&stream->output, iov));
     if (n == -1) {
       success = errno == EWOULDBLOCK;
       break;
     }
 
-    total += n;
+    ring_buffer_consume(&stream->output, n);
   }
 
-  memmove(stream->output, stream->output + total, stream->to_send - total);
-  stream->to_send -= total;
-  if (stream->to_send == 0) {
-    if (reactor_update(stream->reactor, &stream->state, stream->state.events & ~IO_EVENT_WRITE) == -1) {
+  tcp_trim_buffer(stream, &stream->output);
+
+  if (ring_buffer_size(&stream->output) == 0 && !(stream->flags & TCP_EAGER_SEND)) {
+    if (stream->transport->update(stream, stream->state.events & ~IO_EVENT_WRITE) == -1) {
       return -1;
     }
   }
@@ -101,12 +448,26 @@ int tcp_send(TcpStream* stream) {
 }
 
 int tcp_start_recv(TcpStream* stream) {
-  return reactor_update(stream->reactor, &stream->state, stream->state.events | IO_EVENT_READ);
+  return stream->transport->update(stream, stream->state.events | IO_EVENT_READ);
 }
 
 int tcp_recv(TcpStream* stream) {
-  while (stream->received != sizeof(stream->input)) {
-    int n = recv(stream->state.fd, stream->input + stream->received, sizeof(stream->input) - stream->received, 0);
+  RingBuffer* input = &stream->input;
+  if (tcp_attach_buffer(stream, input) == -1) {
+    return -1;
+  }
+
+  if (ring_buffer_space(input) == 0 && ring_buffer_reserve(input, input->capacity) == -1) {
+    return -1;
+  }
+
+  if (stream->flags & TCP_TIMESTAMPING) {
+    tcp_collect_tx_timestamps(stream);
+  }
+
+  while (ring_buffer_space(input) != 0) {
+    struct iovec iov[2];
+    int n = tcp_readv(stream, iov, ring_buffer_space_iov(input, iov));
     if (n == 0) {
       // Connection closed
       return 0;
@@ -119,18 +480,60 @@ int tcp_recv(TcpStream* stream) {
       return -1;
     }
 
-    stream->received += n;
+    ring_buffer_commit(input, n);
   }
 
+  tcp_trim_buffer(stream, input);
   return 1;
 }
 
+int tcp_received(TcpStream* stream) {
+  return ring_buffer_size(&stream->input);
+}
+
+bool tcp_input_full(TcpStream* stream) {
+  // a detached buffer has no space, but nothing has been read into it
+  return stream->input.capacity != 0 && ring_buffer_space(&stream->input) == 0;
+}
+
+const char* tcp_peek(TcpStream* stream, int n, char* scratch) {
+  return ring_buffer_peek(&stream->input, n, scratch);
+}
+
 int tcp_consume(TcpStream* stream, int n) {
-  if (n > stream->received) {
+  if (n > ring_buffer_size(&stream->input)) {
     return -1;
   }
 
-  memmove(stream->input, stream->input + n, stream->received - n);
-  stream->received -= n;
+  ring_buffer_consume(&stream->input, n);
+  tcp_trim_buffer(stream, &stream->input);
   return 0;
 }
+
+int tcp_pending(TcpStream* stream) {
+  return ring_buffer_size(&stream->output);
+}
+
+int tcp_input_iov(TcpStream* stream, struct iovec iov[2]) {
+  return ring_buffer_data_iov(&stream->input, iov);
+}
+
+int tcp_output_iov(TcpStream* stream, struct iovec iov[2]) {
+  return ring_buffer_data_iov(&stream->output, iov);
+}
+
+int tcp_push_input(TcpStream* stream, const char* data, int size) {
+  if (size == 0) {
+    return 0;
+  }
+
+  if (tcp_attach_buffer(stream, &stream->input) == -1) {
+    return -1;
+  }
+
+  return ring_buffer_write(&stream->input, data, size);
+}
+
+uint64_t tcp_output_end(TcpStream* stream) {
+  return stream->sent_bytes + ring_buffer_size(&stream->output);
+}
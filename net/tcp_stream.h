@@ -1,26 +1,73 @@
 #ifndef TCP_STREAM_H
 #define TCP_STREAM_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "reactor.h"
+#include "buffer_pool.h"
+#include "ring_buffer.h"
+#include "transport.h"
 
+// Initial size of stream buffers, they grow on demand up to NET_BUFFER_MAX_SIZE
 #define NET_BUFFER_SIZE 512
-
-
-typedef struct TcpStream {
-  // IO state: socket and list of subscribed events
-  // WARNING: must be a first field
+#define NET_BUFFER_MAX_SIZE (64 * 1024)
+
+// Stream flags
+enum {
+  // Subscribe to IO_EVENT_WRITE once and send() right from tcp_start_send()
+  TCP_EAGER_SEND = 1 << 0,
+  // Hold output back until tcp_uncork()
+  TCP_CORKED = 1 << 1,
+  // Collect kernel timestamps of received and transmitted data, see tcp_set_timestamping()
+  TCP_TIMESTAMPING = 1 << 2,
+};
+
+
+// Kernel view of a tcp connection, see tcp_get_info()
+typedef struct {
+  // Smoothed round trip time and its deviation, us
+  uint32_t rtt_us;
+  uint32_t rttvar_us;
+  // Segments retransmitted over the lifetime of the connection
+  uint32_t retransmits;
+  // Congestion window, segments
+  uint32_t cwnd;
+  // Bytes which are sent, but not acknowledged yet
+  uint32_t unacked_bytes;
+  // Bytes which are in the socket send queue, but not sent yet
+  uint32_t unsent_bytes;
+} TcpInfo;
+
+struct TcpStream {
+  // IO state: socket (-1 for in-process transports), list of subscribed events and their handler
   Evented state;
   // A reactor to which this tcp stream is bound
   Reactor* reactor;
+  unsigned flags;
+
+  // Backend moving bytes of this stream and its state
+  const TransportOps* transport;
+  void* transport_data;
+
+  // Pool to take buffer blocks from, NULL to allocate them once and keep them
+  BufferPool* buffers;
 
   // Buffer to received data
-  char input[NET_BUFFER_SIZE];
-  int received;
+  RingBuffer input;
 
   // Buffer to sent data
-  char output[NET_BUFFER_SIZE];
-  int to_send;
-} TcpStream;
+  RingBuffer output;
+  // Bytes passed to the transport so far
+  uint64_t sent_bytes;
+
+  // Kernel timestamps collected with TCP_TIMESTAMPING, CLOCK_MONOTONIC ns, 0 until known
+  // When the data returned by the latest read of tcp_recv() has arrived
+  uint64_t rx_ns;
+  // When the first |tx_bytes| bytes of the stream were handed to the device
+  uint64_t tx_ns;
+  uint64_t tx_bytes;
+};
 
 // Create a new non-blocking tcp stream
 int tcp_init(TcpStream* stream, Reactor* loop);
@@ -28,13 +75,49 @@ int tcp_init(TcpStream* stream, Reactor* loop);
 // Init tcp stream from existing socket (e.g. from accept())
 int tcp_from_socket(TcpStream* stream, Reactor* loop, int socket);
 
-// Close tcp stream
+// Init stream over |transport|, |fd| is -1 unless the transport is backed by a descriptor
+int tcp_from_transport(TcpStream* stream, Reactor* loop, int fd, const TransportOps* transport, void* data);
+
+// Connect two streams with a pair of AF_UNIX sockets
+int tcp_socketpair(TcpStream* first, TcpStream* second, Reactor* loop);
+
+// Connect two streams with an in-memory pipe, readiness is delivered through reactor_defer()
+// The streams must stay at their addresses and on |loop| until they are closed
+int tcp_memory_pair(TcpStream* first, TcpStream* second, Reactor* loop);
+
+// Close tcp stream and free its buffers
 void tcp_close(TcpStream* stream);
 
 // Shutdown tcp stream connection
 void tcp_shutdown(TcpStream* stream);
 
-// Start a connect operation
+// Switch |stream| to eager send mode: it's subscribed to IO_EVENT_WRITE for good,
+// so sending never updates the reactor, and tcp_start_send() sends what the socket takes
+// and only buffers the rest, which is flushed by tcp_send() on IO_EVENT_WRITE
+int tcp_set_eager_send(TcpStream* stream);
+
+// Attach buffers of |stream| to |pool| only while they hold data, so an idle stream has no I/O memory
+// The pool must have NET_BUFFER_SIZE blocks
+void tcp_set_buffer_pool(TcpStream* stream, BufferPool* pool);
+
+// Limit growth of the input and output buffers
+void tcp_set_max_buffer_size(TcpStream* stream, int input_size, int output_size);
+
+// Busy poll the device queue for up to |usecs| when there is no data to read
+// Requires CAP_NET_ADMIN to exceed net.core.busy_read, does nothing for in-process transports
+int tcp_set_busy_poll(TcpStream* stream, int usecs);
+
+// Collect SO_TIMESTAMPING software timestamps: tcp_recv() records arrival time of the data it reads
+// to |rx_ns|, tcp_send() and tcp_recv() drain transmit timestamps from the error queue to |tx_ns|
+// Reads and writes take a syscall more, so it's meant for latency attribution, not for production
+// returns: -1 on error (EOPNOTSUPP if |stream| is not a socket), 0 otherwise
+int tcp_set_timestamping(TcpStream* stream);
+
+// Sample TCP_INFO and the send queue of the socket of |stream|
+// returns: -1 on error (EOPNOTSUPP if |stream| is not a tcp socket), 0 otherwise
+int tcp_get_info(TcpStream* stream, TcpInfo* info);
+
+// Start a connect operation, streams of in-process pairs are connected already and only report it
 int tcp_start_connect(TcpStream* stream, const char* ip, unsigned short port);
 
 // Process a connect operation
@@ -44,10 +127,30 @@ int tcp_connect(TcpStream* stream);
 // Start send() operation
 // Returns:
 //  -1    on error
-//   0    if there is not enough space in output buffer
+//   0    if the output buffer can't grow to fit |data|
 //   size on success
 int tcp_start_send(TcpStream* stream, const char* data, int size);
 
+// Reserve |size| bytes at the end of the output buffer, so a message is serialized right into it
+// The buffer doesn't grow or move queued output for them, that's left to tcp_start_send()
+// returns: pointer to the region, valid until the next call on |stream|,
+//          NULL if there are no |size| free bytes right after the queued output,
+//          then the message is serialized elsewhere and passed to tcp_start_send()
+char* tcp_reserve(TcpStream* stream, int size);
+
+// Queue |size| bytes written to the region returned by tcp_reserve() and start sending them
+// like tcp_start_send() does, |size| is at most the reserved size
+// returns: -1 on error, 0 otherwise
+int tcp_commit(TcpStream* stream, int size);
+
+// Cork |stream|: tcp_start_send() only buffers data and tcp_send() does nothing,
+// so messages produced in a burst go out together
+void tcp_cork(TcpStream* stream);
+
+// Uncork |stream| and send all buffered data at once
+// The rest is sent on IO_EVENT_WRITE if the socket doesn't take everything
+int tcp_uncork(TcpStream* stream);
+
 // Process send() operation
 // Requires: IO_EVENT_WRITE
 int tcp_send(TcpStream* stream);
@@ -56,14 +159,41 @@ int tcp_send(TcpStream* stream);
 int tcp_start_recv(TcpStream* stream);
 
 // Process recv() operation
+// Reads until the socket is drained or the input buffer is full,
+// the buffer only grows if it was full already (i.e. a message does not fit)
 // Requres: IO_EVENT_READ
 // Returns:
 //  -1 on error
 //  0  if stream have been closed
-//  1  on success, check stream->received for number of bytes in the input buffer
+//  1  on success, check tcp_received() for number of bytes in the input buffer
 int tcp_recv(TcpStream* stream);
 
+// returns: number of bytes in the input buffer
+int tcp_received(TcpStream* stream);
+
+// returns: true if the input buffer is full, i.e. the socket could have more
+bool tcp_input_full(TcpStream* stream);
+
+// returns: pointer to the first |n| received bytes, they are copied to |scratch| if they are not contiguous
+const char* tcp_peek(TcpStream* stream, int n, char* scratch);
+
 // Consume |n| bytes from input buffer
 int tcp_consume(TcpStream* stream, int n);
 
+// returns: number of bytes in the output buffer, which are not sent yet
+int tcp_pending(TcpStream* stream);
+
+// Describe unread input and unsent output as at most 2 segments, e.g. to move |stream| to another process
+// returns: number of segments
+int tcp_input_iov(TcpStream* stream, struct iovec iov[2]);
+int tcp_output_iov(TcpStream* stream, struct iovec iov[2]);
+
+// Put |size| bytes of |data| to the input buffer as if they were received
+// returns: -1 if they don't fit, 0 otherwise
+int tcp_push_input(TcpStream* stream, const char* data, int size);
+
+// returns: offset in the stream of the end of the buffered output,
+// the data is transmitted once |tx_bytes| reaches it
+uint64_t tcp_output_end(TcpStream* stream);
+
 #endif // TCP_STREAM_H
@@ -0,0 +1,207 @@
+#include "timer.h"
+
+#include <stddef.h>
+
+// Pseudo level for the list of expired timers which are about to be fired
+#define TIMER_EXPIRED TIMER_WHEEL_LEVELS
+
+static Timer** timer_list(TimerWheel* wheel, Timer* timer) {
+  if (timer->level == TIMER_EXPIRED) {
+    return &wheel->expired;
+  }
+  return &wheel->slots[timer->level][timer->slot];
+}
+
+static void timer_link(TimerWheel* wheel, Timer* timer, int level, int slot) {
+  timer->level = level;
+  timer->slot = slot;
+
+  Timer** head = timer_list(wheel, timer);
+  timer->prev = NULL;
+  timer->next = *head;
+  if (*head != NULL) {
+    (*head)->prev = timer;
+  }
+  *head = timer;
+
+  if (level != TIMER_EXPIRED) {
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+  }
+}
+
+static void timer_unlink(TimerWheel* wheel, Timer* timer) {
+  Timer** head = timer_list(wheel, timer);
+  if (timer->prev != NULL) {
+    timer->prev->next = timer->next;
+  }
+  else {
+    *head = timer->next;
+  }
+
+  if (timer->next != NULL) {
+    timer->next->prev = timer->prev;
+  }
+
+  if (timer->level != TIMER_EXPIRED && *head == NULL) {
+    wheel->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+  }
+
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->level = -1;
+}
+
+// Put |timer| into the slot according to its expiration time
+static void timer_place(TimerWheel* wheel, Timer* timer) {
+  uint64_t expires = timer->expires;
+  if (expires <= wheel->now) {
+    // already expired, fire on the next advance
+    expires = wheel->now + 1;
+  }
+
+  uint64_t delta = expires - wheel->now;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1))) {
+    level++;
+  }
+
+  uint64_t range = (uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  if (delta >= range) {
+    // too far away, park it in the farthest slot and cascade later
+    expires = wheel->now + range - 1;
+  }
+
+  int slot = (expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+  timer_link(wheel, timer, level, slot);
+}
+
+void timer_init(Timer* timer, TimerCallback callback, void* context) {
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->expires = 0;
+  timer->level = -1;
+  timer->slot = -1;
+  timer->callback = callback;
+  timer->context = context;
+}
+
+bool timer_pending(Timer* timer) {
+  return timer->level != -1;
+}
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now) {
+  wheel->now = now;
+  wheel->expired = NULL;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    wheel->occupied[level] = 0;
+    for (int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+      wheel->slots[level][slot] = NULL;
+    }
+  }
+}
+
+void timer_wheel_add(TimerWheel* wheel, Timer* timer, uint64_t expires) {
+  if (timer_pending(timer)) {
+    timer_unlink(wheel, timer);
+  }
+
+  timer->expires = expires;
+  timer_place(wheel, timer);
+}
+
+void timer_wheel_remove(TimerWheel* wheel, Timer* timer) {
+  if (timer_pending(timer)) {
+    timer_unlink(wheel, timer);
+  }
+}
+
+// Move all timers of |level|/|slot| to |list|
+static void timer_wheel_detach(TimerWheel* wheel, int level, int slot, Timer** list) {
+  Timer* timer = wheel->slots[level][slot];
+  while (timer != NULL) {
+    Timer* next = timer->next;
+    timer->next = *list;
+    *list = timer;
+    timer = next;
+  }
+
+  wheel->slots[level][slot] = NULL;
+  wheel->occupied[level] &= ~((uint64_t)1 << slot);
+}
+
+int timer_wheel_advance(TimerWheel* wheel, uint64_t now) {
+  if (now <= wheel->now) {
+    return 0;
+  }
+
+  // collect timers of every slot whose period has started in (wheel->now, now]
+  Timer* detached = NULL;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    int shift = TIMER_WHEEL_BITS * level;
+    uint64_t first = (wheel->now >> shift) + 1;
+    uint64_t last = now >> shift;
+    if (last < first) {
+      break;
+    }
+
+    if (last - first >= TIMER_WHEEL_SLOTS) {
+      last = first + TIMER_WHEEL_SLOTS - 1;
+    }
+
+    for (uint64_t period = first; period <= last; ++period) {
+      int slot = period & (TIMER_WHEEL_SLOTS - 1);
+      if (wheel->occupied[level] & ((uint64_t)1 << slot)) {
+        timer_wheel_detach(wheel, level, slot, &detached);
+      }
+    }
+  }
+
+  wheel->now = now;
+
+  // fire expired timers and cascade the rest to the lower levels
+  while (detached != NULL) {
+    Timer* timer = detached;
+    detached = timer->next;
+    if (timer->expires <= now) {
+      timer_link(wheel, timer, TIMER_EXPIRED, 0);
+    }
+    else {
+      timer_place(wheel, timer);
+    }
+  }
+
+  // callbacks are allowed to add or remove any timer (including expired ones)
+  int n_expired = 0;
+  while (wheel->expired != NULL) {
+    Timer* timer = wheel->expired;
+    timer_unlink(wheel, timer);
+    timer->callback(timer->context);
+    n_expired++;
+  }
+
+  return n_expired;
+}
+
+uint64_t timer_wheel_next(TimerWheel* wheel) {
+  uint64_t next = UINT64_MAX;
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+    uint64_t occupied = wheel->occupied[level];
+    if (occupied == 0) {
+      continue;
+    }
+
+    // distance (in periods of this level) to the next non-empty slot
+    int shift = TIMER_WHEEL_BITS * level;
+    uint64_t period = wheel->now >> shift;
+    int start = (period + 1) & (TIMER_WHEEL_SLOTS - 1);
+    uint64_t rotated = (occupied >> start) | (start == 0 ? 0 : occupied << (TIMER_WHEEL_SLOTS - start));
+    uint64_t distance = (uint64_t)__builtin_ctzll(rotated) + 1;
+
+    uint64_t time = (period + distance) << shift;
+    if (time < next) {
+      next = time;
+    }
+  }
+
+  return next;
+}
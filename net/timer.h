@@ -0,0 +1,56 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef void (*TimerCallback)(void* context);
+
+typedef struct Timer {
+  // Neighbours in the wheel slot
+  struct Timer* next;
+  struct Timer* prev;
+  // Absolute expiration time, ms of monotonic clock
+  uint64_t expires;
+  // Position in the wheel, level is -1 if timer is not scheduled
+  int level;
+  int slot;
+
+  TimerCallback callback;
+  void* context;
+} Timer;
+
+// Hierarchical timing wheel with 1ms resolution
+// Slot of level L covers 64^L ms, so 4 levels cover ~4.6 hours,
+// timers which are further away are cascaded down multiple times
+typedef struct TimerWheel {
+  // Current time of the wheel, ms of monotonic clock
+  uint64_t now;
+  // Bitmask of non-empty slots for every level
+  uint64_t occupied[TIMER_WHEEL_LEVELS];
+  Timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  // Timers which have expired during the current advance, but not fired yet
+  Timer* expired;
+} TimerWheel;
+
+void timer_init(Timer* timer, TimerCallback callback, void* context);
+// returns: true if |timer| is scheduled
+bool timer_pending(Timer* timer);
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now);
+// Schedule |timer| to fire at |expires|, reschedules already pending timer
+// O(1)
+void timer_wheel_add(TimerWheel* wheel, Timer* timer, uint64_t expires);
+// O(1)
+void timer_wheel_remove(TimerWheel* wheel, Timer* timer);
+// Advance the wheel to |now| and run callbacks of expired timers
+// returns: number of expired timers
+int timer_wheel_advance(TimerWheel* wheel, uint64_t now);
+// returns: time at which the wheel has to be advanced next, UINT64_MAX if it's empty
+uint64_t timer_wheel_next(TimerWheel* wheel);
+
+#endif // TIMER_H
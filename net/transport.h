@@ -0,0 +1,34 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct TcpStream TcpStream;
+
+// Backend which moves bytes of a stream, e.g. a socket or an in-memory pipe
+typedef struct TransportOps {
+  const char* name;
+
+  // readv()/writev() semantics: -1 with EAGAIN if the call would block,
+  // readv() returns 0 once the peer has closed the stream
+  ssize_t (*readv)(TcpStream* stream, const struct iovec* iov, int iovcnt);
+  ssize_t (*writev)(TcpStream* stream, const struct iovec* iov, int iovcnt);
+  // Subscribe |stream| to |events|, the transport reports readiness which is already there
+  int (*update)(TcpStream* stream, unsigned events);
+  void (*shutdown)(TcpStream* stream);
+  // Deregister |stream| and release the transport
+  void (*close)(TcpStream* stream);
+
+  // A stream could be moved to another memory location and thread (see server handoff)
+  bool movable;
+} TransportOps;
+
+// Kernel sockets: TCP and AF_UNIX
+extern const TransportOps SOCKET_TRANSPORT;
+// Both ends live in one process and share a reactor, no syscalls at all
+extern const TransportOps MEMORY_TRANSPORT;
+
+#endif // TRANSPORT_H
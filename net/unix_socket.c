@@ -0,0 +1,171 @@
+#include "unix_socket.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+// Fill |address| with |path|
+static int unix_address(struct sockaddr_un* address, const char* path) {
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, path);
+  return 0;
+}
+
+int unix_listen(const char* path) {
+  struct sockaddr_un address;
+  if (unix_address(&address, path) == -1) {
+    return -1;
+  }
+
+  int s = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (s == -1) {
+    return -1;
+  }
+
+  // connect() fails until listen(), so the mode is set before anyone can get in
+  unlink(path);
+  if (bind(s, (struct sockaddr*)&address, sizeof(address)) == -1 || chmod(path, 0600) == -1 || listen(s, 1) == -1) {
+    close(s);
+    return -1;
+  }
+
+  return s;
+}
+
+int unix_connect(const char* path) {
+  struct sockaddr_un address;
+  if (unix_address(&address, path) == -1) {
+    return -1;
+  }
+
+  int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (s == -1) {
+    return -1;
+  }
+
+  if (connect(s, (struct sockaddr*)&address, sizeof(address)) == -1) {
+    close(s);
+    return -1;
+  }
+
+  return s;
+}
+
+int unix_peer_uid(int socket, uid_t* uid) {
+  struct ucred credentials;
+  socklen_t size = sizeof(credentials);
+  if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == -1) {
+    return -1;
+  }
+
+  *uid = credentials.uid;
+  return 0;
+}
+
+int unix_send_fds(int socket, const int* fds, int n) {
+  // descriptors ride along with a single byte of data
+  char byte = 0;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  char control[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+  memset(control, 0, sizeof(control));
+  struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1,
+                           .msg_control = control, .msg_controllen = CMSG_SPACE(sizeof(int) * n)};
+  struct cmsghdr* c = CMSG_FIRSTHDR(&message);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof(int) * n);
+  memcpy(CMSG_DATA(c), fds, sizeof(int) * n);
+
+  while (sendmsg(socket, &message, MSG_NOSIGNAL) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int unix_recv_fds(int socket, int* fds, int n) {
+  char byte;
+  struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+  char control[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+  struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1,
+                           .msg_control = control, .msg_controllen = sizeof(control)};
+  ssize_t received;
+  while ((received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC)) == -1) {
+    if (errno != EINTR) {
+      return -1;
+    }
+  }
+
+  struct cmsghdr* c = CMSG_FIRSTHDR(&message);
+  if (received != 1 || c == NULL || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS ||
+      c->cmsg_len != CMSG_LEN(sizeof(int) * n) || (message.msg_flags & MSG_CTRUNC)) {
+    // descriptors which did arrive are ours already
+    for (; c != NULL; c = CMSG_NXTHDR(&message, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        int received_fds[UNIX_MAX_FDS];
+        int n_received = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(received_fds, CMSG_DATA(c), n_received * sizeof(int));
+        for (int i = 0; i < n_received; ++i) {
+          close(received_fds[i]);
+        }
+      }
+    }
+
+    errno = EPROTO;
+    return -1;
+  }
+
+  memcpy(fds, CMSG_DATA(c), sizeof(int) * n);
+  return 0;
+}
+
+int unix_write_all(int socket, const void* data, size_t size) {
+  const char* bytes = data;
+  while (size > 0) {
+    ssize_t n = send(socket, bytes, size, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    bytes += n;
+    size -= n;
+  }
+  return 0;
+}
+
+int unix_read_all(int socket, void* data, size_t size) {
+  char* bytes = data;
+  while (size > 0) {
+    ssize_t n = read(socket, bytes, size);
+    if (n == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    bytes += n;
+    size -= n;
+  }
+  return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef UNIX_SOCKET_H
+#define UNIX_SOCKET_H
+
+#include <stddef.h>
+
+#include <sys/types.h>
+
+// Descriptors passed by a single unix_send_fds() call at most
+#define UNIX_MAX_FDS 64
+
+// Listen on a non-blocking AF_UNIX stream socket at |path|, a stale socket file is replaced
+// The socket file is 0600, so only processes of the same user (or root) can connect
+// returns: -1 on error, the socket otherwise
+int unix_listen(const char* path);
+
+// Get the user of the process on the other end of connected |socket| (SO_PEERCRED)
+int unix_peer_uid(int socket, uid_t* uid);
+
+// Connect a blocking AF_UNIX stream socket to |path|
+// returns: -1 on error, the socket otherwise
+int unix_connect(const char* path);
+
+// Pass |n| (at most UNIX_MAX_FDS) descriptors over blocking |socket| with SCM_RIGHTS
+int unix_send_fds(int socket, const int* fds, int n);
+
+// Receive |n| descriptors sent by a single unix_send_fds() call
+int unix_recv_fds(int socket, int* fds, int n);
+
+// Write or read exactly |size| bytes over blocking |socket|
+int unix_write_all(int socket, const void* data, size_t size);
+int unix_read_all(int socket, void* data, size_t size);
+
+#endif // UNIX_SOCKET_H
@@ -0,0 +1,56 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper on top of raw syscalls (no liburing dependency)
+typedef struct Uring {
+  int fd;
+
+  // Submission queue (shared with kernel)
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  struct io_uring_sqe* sqes;
+  // Number of prepared, but not yet submitted entries
+  unsigned to_submit;
+  // io_uring_enter() calls so far, for instrumentation
+  uint64_t enters;
+
+  // Completion queue (shared with kernel)
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+
+  // mmap'ed regions
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+} Uring;
+
+int uring_init(Uring* ring, unsigned entries);
+void uring_close(Uring* ring);
+
+// Get a zeroed submission queue entry
+// Submits already prepared entries if the submission queue is full
+// returns: NULL on error
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+
+// Submit prepared entries and wait for at least |wait_nr| completions
+// or |timeout_ms| (negative means infinite), whichever comes first
+// returns: -1 on error, number of submitted entries otherwise
+int uring_enter(Uring* ring, unsigned wait_nr, int timeout_ms);
+
+// returns: pointer to the oldest unconsumed completion or NULL if there is none
+struct io_uring_cqe* uring_peek_cqe(Uring* ring);
+// Mark |n| completions as consumed
+void uring_advance(Uring* ring, unsigned n);
+
+#endif // URING_H
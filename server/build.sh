@@ -5,6 +5,7 @@ clang -o server scu.c                       \
       -O2 -flto                             \
       -fuse-ld=lld                          \
       -fvisibility=hidden                   \
+      -pthread                              \
       -Werror=implicit-function-declaration \
       -Werror=implicit-int                  \
       -Werror=int-conversion                \
@@ -2,43 +2,261 @@
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <stdbool.h>
+
+#include <pthread.h>
 
 #include "log.h"
 #include "server.h"
+#include "restart.h"
 
 
-static Server* s;
+static Server* workers;
+static int n_workers;
+// Set once the server is asked to stop, so a failed hot restart doesn't resume the workers
+static volatile sig_atomic_t stopping;
 
 static void sigint(int signal) {
   (void)signal;
-  server_stop(s);
+  stopping = 1;
+  for (int i = 0; i < n_workers; ++i) {
+    server_stop(&workers[i]);
+  }
+}
+
+// kill -USR1 <pid> makes every worker log its loop statistics
+static void sigusr1(int signal) {
+  (void)signal;
+  for (int i = 0; i < n_workers; ++i) {
+    server_request_stats(&workers[i]);
+  }
+}
+
+// Parse a positive integer value of option |argv[*i]|
+static bool parse_int_option(int argc, char* argv[], int* i, int* value) {
+  const char* option = argv[*i];
+  if (*i + 1 == argc) {
+    LOG_ERROR("No value for option %s", option);
+    return false;
+  }
+
+  *i += 1;
+  *value = atoi(argv[*i]);
+  if (*value <= 0) {
+    LOG_ERROR("%s is not a valid value for option %s", argv[*i], option);
+    return false;
+  }
+
+  return true;
+}
+
+// Parse a string value of option |argv[*i]|
+static bool parse_string_option(int argc, char* argv[], int* i, const char** value) {
+  if (*i + 1 == argc) {
+    LOG_ERROR("No value for option %s", argv[*i]);
+    return false;
+  }
+
+  *i += 1;
+  *value = argv[*i];
+  return true;
+}
+
+static bool parse_args(ServerConfig* config, const char** restore_from, int argc, char* argv[]) {
+  int n_positional = 0;
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--io-uring") == 0) {
+      config->backend = REACTOR_BACKEND_IO_URING;
+    }
+    else if (strcmp(arg, "--workers") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->workers)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--idle-timeout") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->idle_timeout_ms)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--busy-poll") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->busy_poll_us)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--read-budget-bytes") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->read_budget_bytes)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--read-budget-messages") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->read_budget_messages)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--max-buffer-size") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->max_buffer_size)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--timestamping") == 0) {
+      config->timestamping = true;
+    }
+    else if (strcmp(arg, "--accept-backlog") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->accept_backlog)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--accept-budget") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->accept_budget)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--max-connections") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->max_connections)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--max-lobbies") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->max_lobbies)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--simulation-threads") == 0) {
+      if (!parse_int_option(argc, argv, &i, &config->simulation_threads)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--restart-socket") == 0) {
+      if (!parse_string_option(argc, argv, &i, &config->restart_socket)) {
+        return false;
+      }
+    }
+    else if (strcmp(arg, "--restore-from") == 0) {
+      if (!parse_string_option(argc, argv, &i, restore_from)) {
+        return false;
+      }
+    }
+    else if (strncmp(arg, "--", 2) == 0) {
+      LOG_ERROR("Unknown option: %s", arg);
+      return false;
+    }
+    else if (n_positional == 0) {
+      config->host = arg;
+      n_positional++;
+    }
+    else if (n_positional == 1) {
+      config->port = (unsigned short)atoi(arg);
+      if (config->port == 0) {
+        LOG_ERROR("%s is not a valid port number", arg);
+        return false;
+      }
+      n_positional++;
+    }
+    else {
+      LOG_ERROR("Too many arguments, expected at most 2");
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void* run_worker(void* worker) {
+  Server* server = worker;
+  if (server_run(server) != 0) {
+    // one worker failed, shut down the rest of them
+    sigint(SIGINT);
+    return server;
+  }
+
+  return NULL;
+}
+
+static void* resume_worker(void* worker) {
+  Server* server = worker;
+  if (server_resume(server) != 0) {
+    sigint(SIGINT);
+    return server;
+  }
+
+  return NULL;
+}
+
+// Run every worker with |run| until they stop, worker #0 runs on the main thread
+// returns: false if any of them has failed
+static bool run_workers(void* (*run)(void*)) {
+  pthread_t threads[n_workers];
+  int n_threads = 0;
+  for (int i = 1; i < n_workers; ++i) {
+    if (pthread_create(&threads[i], NULL, run, &workers[i]) != 0) {
+      LOG_ERROR("Failed to start worker #%d", i);
+      sigint(SIGINT);
+      break;
+    }
+    n_threads++;
+  }
+
+  bool success = run(&workers[0]) == NULL;
+  for (int i = 1; i <= n_threads; ++i) {
+    void* result = NULL;
+    pthread_join(threads[i], &result);
+    success = success && result == NULL;
+  }
+
+  return success;
 }
 
 int main(int argc, char* argv[]) {
-  // ./server 127.0.0.1 1337
-  if (argc > 3) {
-    LOG_ERROR("Too many arguments, expected at most 2");
+  // ./server 127.0.0.1 1337 [--io-uring] [--workers N] [--idle-timeout MS] [--busy-poll US]
+  //          [--read-budget-bytes N] [--read-budget-messages N] [--max-buffer-size N] [--timestamping]
+  //          [--accept-backlog N] [--accept-budget N] [--max-connections N] [--max-lobbies N]
+  //          [--simulation-threads N] [--restart-socket PATH] [--restore-from PATH]
+  // --max-connections and --max-lobbies are limits of every worker
+  // --restore-from takes over the server which runs with --restart-socket PATH, its address and workers
+  ServerConfig config;
+  server_config_init(&config);
+  const char* restore_from = NULL;
+  if (!parse_args(&config, &restore_from, argc, argv)) {
     return EXIT_FAILURE;
   }
 
-  const char* host = argc < 2 ? "127.0.0.1" : argv[1];
-  unsigned short port = 1337;
-  if (argc == 3) {
-    port = (unsigned short)atoi(argv[2]);
+  RestartReader restore = {0};
+  int predecessor = -1;
+  if (restore_from != NULL) {
+    predecessor = restart_receive(restore_from, &restore, &config.workers);
+    if (predecessor == -1) {
+      LOG_ERROR("Failed to take over the server at %s: %s", restore_from, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    LOG_INFO("Taking over the server at %s", restore_from);
+  }
+  else {
+    LOG_INFO("Starting at %s:%d", config.host, config.port);
+  }
 
-    if (port == 0) {
-      LOG_ERROR("%s is not a valid port number", argv[2]);
+  workers = calloc(config.workers, sizeof(Server));
+  if (workers == NULL) {
+    LOG_ERROR("Failed to allocate %d workers", config.workers);
+    return EXIT_FAILURE;
+  }
+
+  for (int i = 0; i < config.workers; ++i) {
+    int status = restore_from != NULL ? server_init_restored(&workers[i], &config, i, workers, &restore)
+                                       : server_init(&workers[i], &config, i, workers);
+    if (status < 0) {
       return EXIT_FAILURE;
     }
   }
+  restart_reader_free(&restore);
+  n_workers = config.workers;
 
-  LOG_INFO("Starting at %s:%d", host, port);
-  Server server;
-  if (server_init(&server, host, port) < 0) {
+  // the old process serves the clients until it confirms, they must not be touched otherwise
+  if (predecessor != -1 && !restart_confirm(predecessor)) {
+    LOG_ERROR("The server at %s has not handed the clients over, it keeps serving them", restore_from);
     return EXIT_FAILURE;
   }
 
-  s = &server;
   struct sigaction handler = {
     .sa_handler = sigint,
     .sa_mask = 0,
@@ -48,9 +266,31 @@ int main(int argc, char* argv[]) {
     LOG_ERROR("Failed to install signal handler: %s", strerror(errno));
   }
 
-  bool success = server_run(&server) == 0;
-  server_close(&server);
+  handler.sa_handler = sigusr1;
+  if (sigaction(SIGUSR1, &handler, NULL) == -1) {
+    LOG_ERROR("Failed to install signal handler: %s", strerror(errno));
+  }
+
+  bool success = run_workers(run_worker);
+
+  // with a successful handover the clients stay connected to the new process,
+  // after a failed one this process goes on serving them
+  bool restarted = false;
+  while (success && workers[0].successor != -1) {
+    restarted = restart_handover(workers, n_workers);
+    if (restarted || stopping) {
+      break;
+    }
+
+    LOG_WARN("The new process has not taken over, resuming the workers");
+    success = run_workers(resume_worker);
+  }
+
+  for (int i = 0; i < n_workers; ++i) {
+    server_close(&workers[i]);
+  }
+  free(workers);
 
-  LOG_INFO("Closed %s", success ? "successfully" : "due to error");
+  LOG_INFO("Closed %s", restarted ? "after handing over to the new process" : success ? "successfully" : "due to error");
   return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -5,9 +5,20 @@
 #include <stdalign.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t pool_page_size(void) {
+  return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static size_t pool_round_up(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
 // obtain a pointer to start of "in use" bitmask
 static unsigned char* pool_slots(Pool* pool) {
-  return pool_at(pool, pool->max_objects);
+  return (unsigned char*)pool->memory;
 }
 
 static bool pool_slot_get(Pool* pool, int index) {
@@ -24,42 +35,99 @@ static void pool_slot_set(Pool* pool, int index, bool taken) {
   }
 }
 
-void pool_init(Pool* pool, char* memory, int capacity, int object_size, int alignment) {
-  assert((intptr_t)memory % alignment == 0);
+int pool_init(Pool* pool, int object_size, int alignment, int max_objects) {
   assert(object_size >= sizeof(void*));
   assert(alignment >= alignof(void*));
+  assert(object_size % alignment == 0);
+  assert(max_objects > 0);
+
+  // objects start at a page boundary, so they are aligned as well
+  size_t page = pool_page_size();
+  size_t slots_size = pool_round_up((max_objects + 7) / 8, page);
+  size_t reserved = slots_size + pool_round_up((size_t)object_size * max_objects, page);
+
+  // reserved address space costs no memory until it's made accessible
+  char* memory = mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (memory == MAP_FAILED) {
+    return -1;
+  }
+
+  // the bitmask is small (a bit per object), pages of it are populated on first write
+  if (mprotect(memory, slots_size, PROT_READ | PROT_WRITE) == -1) {
+    munmap(memory, reserved);
+    return -1;
+  }
 
   pool->memory = memory;
-  pool->capacity = capacity;
+  pool->reserved = reserved;
+  pool->objects = memory + slots_size;
 
   pool->object_size = object_size;
   pool->n_objects = 0;
-  // max_objects = capacity / (object_size + 1/8)
-  pool->max_objects = (capacity * 8) / (object_size * 8 + 1);
-  pool->free = pool_at(pool, 0);
+  pool->n_committed = 0;
+  pool->max_objects = max_objects;
+  pool->free = NULL;
+  return 0;
+}
 
-  // initialize free list
-  for (int i = 0; i < pool->max_objects - 1; ++i) {
-    void* current = pool_at(pool, i);
-    void* next = pool_at(pool, i + 1);
-    *(void**)current = next;
+void pool_close(Pool* pool) {
+  munmap(pool->memory, pool->reserved);
+  pool->memory = NULL;
+  pool->objects = NULL;
+  pool->n_objects = 0;
+  pool->n_committed = 0;
+  pool->free = NULL;
+}
+
+// Commit the next segment of memory and put its objects to the free list
+// returns: -1 if the pool is at capacity or memory could not be committed, 0 otherwise
+static int pool_grow(Pool* pool) {
+  if (pool->n_committed == pool->max_objects) {
+    return -1;
   }
 
-  void* last = pool_at(pool, pool->max_objects - 1);
-  *(void**)last = NULL;
+  size_t page = pool_page_size();
+  size_t committed = pool_round_up((size_t)pool->object_size * pool->n_committed, page);
+  size_t target = pool_round_up((size_t)pool->object_size * (pool->n_committed + 1), page);
+  target = pool_round_up(target, POOL_SEGMENT_SIZE);
+  size_t limit = pool->reserved - (pool->objects - pool->memory);
+  if (target > limit) {
+    target = limit;
+  }
 
-  // initialize "in use" mask
-  unsigned char* slots = pool_slots(pool);
-  memset(slots, 0, (pool->max_objects + 7) / 8);
+  if (mprotect(pool->objects + committed, target - committed, PROT_READ | PROT_WRITE) == -1) {
+    return -1;
+  }
+
+  int n_committed = target / pool->object_size;
+  if (n_committed > pool->max_objects) {
+    n_committed = pool->max_objects;
+  }
+
+  // new objects are taken in order of their indices, after the ones which are free already
+  void** link = &pool->free;
+  while (*link != NULL) {
+    link = (void**)*link;
+  }
+
+  for (int i = pool->n_committed; i < n_committed; ++i) {
+    void* object = pool_at(pool, i);
+    *link = object;
+    link = (void**)object;
+  }
+
+  *link = NULL;
+  pool->n_committed = n_committed;
+  return 0;
 }
 
 void* pool_aquire(Pool* pool) {
-  void* entry = pool->free;
-  if (entry == NULL) {
+  if (pool->free == NULL && pool_grow(pool) == -1) {
     // no capacity
     return NULL;
   }
 
+  void* entry = pool->free;
   pool->n_objects++;
   pool->free = *(void**)entry;
   pool_slot_set(pool, pool_index(pool, entry), true);
@@ -67,8 +135,36 @@ void* pool_aquire(Pool* pool) {
   return entry;
 }
 
+void* pool_aquire_at(Pool* pool, int index) {
+  if (index < 0 || index >= pool->max_objects) {
+    return NULL;
+  }
+
+  while (index >= pool->n_committed) {
+    if (pool_grow(pool) == -1) {
+      return NULL;
+    }
+  }
+
+  if (pool_slot_get(pool, index)) {
+    return NULL;
+  }
+
+  // the slot is free, so it's somewhere in the free list
+  void* entry = pool_at(pool, index);
+  void** link = &pool->free;
+  while (*link != entry) {
+    link = (void**)*link;
+  }
+
+  *link = *(void**)entry;
+  pool->n_objects++;
+  pool_slot_set(pool, index, true);
+  return entry;
+}
+
 void* pool_at(Pool* pool, int index) {
-  return pool->memory + pool->object_size * index;
+  return pool->objects + (size_t)pool->object_size * index;
 }
 
 void pool_release(Pool* pool, void* object) {
@@ -80,7 +176,7 @@ void pool_release(Pool* pool, void* object) {
 }
 
 bool pool_contains(Pool* pool, void* object) {
-  if (object < pool_at(pool, 0) || object > pool_at(pool, pool->max_objects - 1)) {
+  if ((char*)object < pool->objects || (char*)object >= pool->objects + (size_t)pool->object_size * pool->n_committed) {
     return false;
   }
 
@@ -94,7 +190,7 @@ bool pool_contains(Pool* pool, void* object) {
 }
 
 int pool_index(Pool* pool, void* object) {
-  return ((char*)object - pool->memory) / pool->object_size;
+  return ((char*)object - pool->objects) / pool->object_size;
 }
 
 int pool_size(Pool* pool) {
@@ -105,8 +201,12 @@ int pool_capacity(Pool* pool) {
   return pool->max_objects;
 }
 
+int pool_committed(Pool* pool) {
+  return pool->n_committed;
+}
+
 static void* pool_search_forward(Pool* pool, int start) {
-  for (int i = start; i < pool->max_objects; ++i) {
+  for (int i = start; i < pool->n_committed; ++i) {
     if (pool_slot_get(pool, i)) {
       return pool_at(pool, i);
     }
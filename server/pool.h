@@ -2,26 +2,36 @@
 #define POOL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
-// returns capacity required to store n objects of type in pool
-#define POOL_CAPACITY(type, n) (n * sizeof(type) + (n + 7) / 8)
+// Address space for |max_objects| is reserved up front, so objects never move,
+// but memory is committed in segments of POOL_SEGMENT_SIZE bytes as the pool grows
+#define POOL_SEGMENT_SIZE (64 * 1024)
 
 typedef struct Pool {
-  char* memory;  // pointer to start of memory block
-  int capacity;  // size of memory block
+  char* memory;    // pointer to start of reserved address space: "in use" bitmask, then objects
+  size_t reserved; // size of reserved address space
+  char* objects;   // pointer to the first object
 
   int object_size; // size of object (including alignment)
   int n_objects;   // current number of objects stored in pool
+  int n_committed; // number of objects backed by committed memory
   int max_objects; // maximum number of objects that this pool can contain
 
   void* free;      // pointer to the head of free list
 } Pool;
 
-// Initialize the pool
-void pool_init(Pool* pool, char* memory, int capacity, int object_size, int alignment);
+// Initialize the pool, no memory for objects is committed yet
+// returns: -1 if address space could not be reserved, 0 otherwise
+int pool_init(Pool* pool, int object_size, int alignment, int max_objects);
+// Return all memory of the pool to the system
+void pool_close(Pool* pool);
 // Allocate memory for object in pool
-// returns: pointer to allocated object, NULL if there is not enough memory
+// returns: pointer to allocated object, NULL if the pool is full or memory could not be committed
 void* pool_aquire(Pool* pool);
+// Allocate the object at |index|, e.g. to restore objects whose indices are known to clients
+// returns: pointer to allocated object, NULL if it's taken or out of range
+void* pool_aquire_at(Pool* pool, int index);
 // Return memory to the pool
 void pool_release(Pool* pool, void* object);
 
@@ -31,7 +41,7 @@ void pool_release(Pool* pool, void* object);
 // 3. object at this location actually have been allocated via pool_aquire()
 bool pool_contains(Pool* pool, void* object);
 // returns a pointer to object at index
-// NOTE: the object could be uninitialized
+// NOTE: the object could be uninitialized or even not backed by memory, see pool_committed()
 void* pool_at(Pool* pool, int index);
 // returns index of object
 // requires: pool_contains(object)
@@ -40,6 +50,8 @@ int pool_index(Pool* pool, void* object);
 int pool_size(Pool* pool);
 // returns maximum number of objects that could be allocated in pool
 int pool_capacity(Pool* pool);
+// returns number of slots backed by memory, all objects have indices below it
+int pool_committed(Pool* pool);
 
 // returns a pointer to the first object in pool
 void* pool_first(Pool* pool);
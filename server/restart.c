@@ -0,0 +1,288 @@
+#include "restart.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "clock.h"
+#include "server.h"
+#include "net/unix_socket.h"
+
+
+// Bump on every change of the format written by server_dump()
+#define RESTART_MAGIC 0x504f4e47
+#define RESTART_VERSION 2
+
+// How long the new process has to take the dump and restore the workers, the old process goes on serving afterwards
+// The workers are stopped meanwhile, so every blocking call of the transfer counts against it
+#define RESTART_TIMEOUT_MS 5000
+// The dump is written in chunks, so a successor which reads slowly can't stretch the timeout much
+#define RESTART_CHUNK_SIZE (64 * 1024)
+
+// Single bytes which finish the handover: the new process has restored the workers,
+// the old process has stopped serving them
+#define RESTART_ACK 'A'
+#define RESTART_CONFIRM 'C'
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int32_t workers;
+  int32_t n_fds;
+  uint64_t size;
+} RestartHeader;
+
+void restart_write(RestartWriter* writer, const void* data, size_t size) {
+  if (writer->failed) {
+    return;
+  }
+
+  if (writer->size + size > writer->capacity) {
+    size_t capacity = writer->capacity > 0 ? writer->capacity : 4096;
+    while (writer->size + size > capacity) {
+      capacity *= 2;
+    }
+
+    char* grown = realloc(writer->data, capacity);
+    if (grown == NULL) {
+      writer->failed = true;
+      return;
+    }
+
+    writer->data = grown;
+    writer->capacity = capacity;
+  }
+
+  memcpy(writer->data + writer->size, data, size);
+  writer->size += size;
+}
+
+void restart_write_fd(RestartWriter* writer, int fd) {
+  if (writer->n_fds == writer->fds_capacity) {
+    int capacity = writer->fds_capacity > 0 ? writer->fds_capacity * 2 : 64;
+    int* grown = realloc(writer->fds, capacity * sizeof(int));
+    if (grown == NULL) {
+      writer->failed = true;
+      return;
+    }
+
+    writer->fds = grown;
+    writer->fds_capacity = capacity;
+  }
+
+  int32_t index = writer->n_fds;
+  writer->fds[writer->n_fds++] = fd;
+  restart_write(writer, &index, sizeof(index));
+}
+
+const char* restart_read_bytes(RestartReader* reader, size_t size) {
+  if (reader->failed || reader->size - reader->offset < size) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  const char* data = reader->data + reader->offset;
+  reader->offset += size;
+  return data;
+}
+
+bool restart_read(RestartReader* reader, void* data, size_t size) {
+  const char* bytes = restart_read_bytes(reader, size);
+  if (bytes == NULL) {
+    memset(data, 0, size);
+    return false;
+  }
+
+  memcpy(data, bytes, size);
+  return true;
+}
+
+int restart_read_fd(RestartReader* reader) {
+  int32_t index = -1;
+  restart_read(reader, &index, sizeof(index));
+  if (index < 0 || index >= reader->n_fds || reader->fds[index] == -1) {
+    reader->failed = true;
+    return -1;
+  }
+
+  // the socket belongs to the caller now
+  int fd = reader->fds[index];
+  reader->fds[index] = -1;
+  return fd;
+}
+
+// Let the next blocking send or receive on |socket| wait till |deadline_ns| at most
+// returns: -1 if the deadline has passed (ETIMEDOUT) or on error, 0 otherwise
+static int restart_set_deadline(int socket, uint64_t deadline_ns) {
+  uint64_t now = clock_now_ns();
+  if (now >= deadline_ns) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+
+  // a zero timeout would block forever
+  uint64_t left_us = (deadline_ns - now) / 1000 > 0 ? (deadline_ns - now) / 1000 : 1;
+  struct timeval timeout = {.tv_sec = left_us / (1000 * 1000), .tv_usec = left_us % (1000 * 1000)};
+  if (setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1 ||
+      setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1) {
+    return -1;
+  }
+
+  return 0;
+}
+
+// Send the dump of |writer| over blocking |socket| before |deadline_ns|
+static int restart_send(int socket, const RestartWriter* writer, int n_workers, uint64_t deadline_ns) {
+  RestartHeader header = {.magic = RESTART_MAGIC, .version = RESTART_VERSION,
+                          .workers = n_workers, .n_fds = writer->n_fds, .size = writer->size};
+  if (restart_set_deadline(socket, deadline_ns) == -1 || unix_write_all(socket, &header, sizeof(header)) == -1) {
+    return -1;
+  }
+
+  for (int i = 0; i < writer->n_fds; i += UNIX_MAX_FDS) {
+    int n = writer->n_fds - i < UNIX_MAX_FDS ? writer->n_fds - i : UNIX_MAX_FDS;
+    if (restart_set_deadline(socket, deadline_ns) == -1 || unix_send_fds(socket, writer->fds + i, n) == -1) {
+      return -1;
+    }
+  }
+
+  for (size_t offset = 0; offset < writer->size; offset += RESTART_CHUNK_SIZE) {
+    size_t n = writer->size - offset < RESTART_CHUNK_SIZE ? writer->size - offset : RESTART_CHUNK_SIZE;
+    if (restart_set_deadline(socket, deadline_ns) == -1 || unix_write_all(socket, writer->data + offset, n) == -1) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+// Wait till |deadline_ns| for the new process to restore the workers, then let it start
+// returns: -1 if it has failed or not answered in time, 0 once it's confirmed
+static int restart_wait_ack(int socket, uint64_t deadline_ns) {
+  char ack = 0;
+  if (restart_set_deadline(socket, deadline_ns) == -1 || unix_read_all(socket, &ack, sizeof(ack)) == -1) {
+    return -1;
+  }
+
+  if (ack != RESTART_ACK) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  // once this is sent the clients belong to the new process
+  char confirm = RESTART_CONFIRM;
+  return unix_write_all(socket, &confirm, sizeof(confirm));
+}
+
+bool restart_handover(Server* workers, int n_workers) {
+  int successor = workers[0].successor;
+  if (successor == -1) {
+    return false;
+  }
+
+  uint64_t start = clock_now_ns();
+  RestartWriter writer = {0};
+  for (int i = 0; i < n_workers; ++i) {
+    server_dump(&workers[i], &writer);
+  }
+
+  uint64_t deadline = start + (uint64_t)RESTART_TIMEOUT_MS * 1000 * 1000;
+  bool success = !writer.failed && restart_send(successor, &writer, n_workers, deadline) == 0 &&
+                 restart_wait_ack(successor, deadline) == 0;
+  if (!success && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    errno = ETIMEDOUT;
+  }
+
+  if (success) {
+    LOG_INFO("Handed %d sockets and %zu bytes of state over to the new process in %llu us",
+             writer.n_fds, writer.size, (unsigned long long)((clock_now_ns() - start) / 1000));
+    for (int i = 0; i < n_workers; ++i) {
+      server_detach(&workers[i]);
+    }
+  }
+  else {
+    LOG_ERROR("Failed to hand the state over to the new process: %s", writer.failed ? "out of memory" : strerror(errno));
+  }
+
+  free(writer.data);
+  free(writer.fds);
+  close(successor);
+  workers[0].successor = -1;
+  return success;
+}
+
+int restart_receive(const char* path, RestartReader* reader, int* n_workers) {
+  memset(reader, 0, sizeof(*reader));
+  int socket = unix_connect(path);
+  if (socket == -1) {
+    return -1;
+  }
+
+  RestartHeader header;
+  if (unix_read_all(socket, &header, sizeof(header)) == -1) {
+    close(socket);
+    return -1;
+  }
+
+  if (header.magic != RESTART_MAGIC || header.version != RESTART_VERSION || header.workers <= 0 || header.n_fds < 0) {
+    LOG_ERROR("Unsupported hot restart format: version %u", header.version);
+    close(socket);
+    errno = EPROTO;
+    return -1;
+  }
+
+  reader->fds = malloc((header.n_fds > 0 ? header.n_fds : 1) * sizeof(int));
+  reader->data = malloc(header.size > 0 ? header.size : 1);
+  if (reader->fds == NULL || reader->data == NULL) {
+    restart_reader_free(reader);
+    close(socket);
+    return -1;
+  }
+
+  for (int i = 0; i < header.n_fds; i += UNIX_MAX_FDS) {
+    int n = header.n_fds - i < UNIX_MAX_FDS ? header.n_fds - i : UNIX_MAX_FDS;
+    if (unix_recv_fds(socket, reader->fds + i, n) == -1) {
+      restart_reader_free(reader);
+      close(socket);
+      return -1;
+    }
+    reader->n_fds += n;
+  }
+
+  if (unix_read_all(socket, reader->data, header.size) == -1) {
+    restart_reader_free(reader);
+    close(socket);
+    return -1;
+  }
+
+  reader->size = header.size;
+  *n_workers = header.workers;
+  return socket;
+}
+
+bool restart_confirm(int socket) {
+  char ack = RESTART_ACK;
+  char confirm = 0;
+  bool confirmed = unix_write_all(socket, &ack, sizeof(ack)) == 0 &&
+                   unix_read_all(socket, &confirm, sizeof(confirm)) == 0 && confirm == RESTART_CONFIRM;
+  close(socket);
+  return confirmed;
+}
+
+void restart_reader_free(RestartReader* reader) {
+  for (int i = 0; i < reader->n_fds; ++i) {
+    if (reader->fds[i] != -1) {
+      close(reader->fds[i]);
+    }
+  }
+
+  free(reader->fds);
+  free(reader->data);
+  memset(reader, 0, sizeof(*reader));
+}
@@ -0,0 +1,72 @@
+#ifndef RESTART_H
+#define RESTART_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct Server;
+
+// Hot restart: a new server process takes over sockets and lobbies of a running one.
+// The old process listens on ServerConfig.restart_socket, once the new one connects there
+// all workers stop and the old process sends:
+//  1. RestartHeader
+//  2. sockets (listeners and connections) in batches of UNIX_MAX_FDS with SCM_RIGHTS
+//  3. the state of every worker written by server_dump(), it refers to the sockets by index
+// The new process acknowledges once its workers are restored and starts when the old one confirms,
+// only then the old process lets go of the clients, without an acknowledgement it keeps serving them
+// Clients keep their tcp connections, they only see a gap of about a tick in the updates
+
+// Serialized state and sockets of the workers
+typedef struct RestartWriter {
+  char* data;
+  size_t size;
+  size_t capacity;
+
+  int* fds;
+  int n_fds;
+  int fds_capacity;
+
+  // Out of memory, the dump is incomplete
+  bool failed;
+} RestartWriter;
+
+typedef struct RestartReader {
+  char* data;
+  size_t size;
+  size_t offset;
+
+  // Sockets which are not taken by restart_read_fd() yet are closed by restart_reader_free()
+  int* fds;
+  int n_fds;
+
+  // The dump is truncated or refers to a missing socket
+  bool failed;
+} RestartReader;
+
+void restart_write(RestartWriter* writer, const void* data, size_t size);
+// Add |fd| to the sockets to pass and write its index
+void restart_write_fd(RestartWriter* writer, int fd);
+
+// returns: false if there is not enough data, |data| is zeroed then
+bool restart_read(RestartReader* reader, void* data, size_t size);
+// returns: pointer to the next |size| bytes of the dump, NULL if there is not enough data
+const char* restart_read_bytes(RestartReader* reader, size_t size);
+// returns: the socket which the next index refers to, -1 if the index is invalid
+int restart_read_fd(RestartReader* reader);
+
+// Hand the state of stopped |workers| over to the process which has connected to ServerConfig.restart_socket
+// Sockets of the workers are closed without disconnecting clients on success
+// returns: false if nobody has connected or the new process hasn't taken over,
+//          the workers still have their clients then and may be resumed
+bool restart_handover(struct Server* workers, int n_workers);
+
+// Connect to the server listening on |path| and receive its state, |n_workers| is the number of its workers
+// returns: -1 on error, the connection to the old process otherwise, see restart_confirm()
+int restart_receive(const char* path, RestartReader* reader, int* n_workers);
+// Acknowledge over |socket| that the workers are restored and wait for the old process to let go of them,
+// |socket| is closed
+// returns: false if the old process keeps serving the clients, the restored workers must not run then
+bool restart_confirm(int socket);
+void restart_reader_free(RestartReader* reader);
+
+#endif // RESTART_H
@@ -2,9 +2,19 @@
 #include "game/protocol.c"
 #include "game/vec2.c"
 #include "game/game.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
+#include "net/shared_buffer.c"
 #include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
 #include "net/tcp_listener.c"
+#include "net/unix_socket.c"
+#include "net/uring.c"
+#include "net/timer.c"
 #include "net/reactor.c"
 #include "pool.c"
+#include "simulation.c"
+#include "restart.c"
 #include "server.c"
 #include "main.c"
@@ -5,50 +5,234 @@
 #include <stdalign.h>
 #include <stdbool.h>
 
+#include <stdlib.h>
+
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "log.h"
+#include "clock.h"
+#include "restart.h"
+#include "net/unix_socket.h"
+
 
+// Connection which is being moved to another worker
+typedef struct Handoff {
+  struct Server* target;
+  Connection connection;
+} Handoff;
 
+// Returned by message handlers when connection was handed over to another worker
+enum { CONNECTION_MOVED = 1 };
+
+// Socket of the connection, in-process connections have none and get negative ids by pool slot
 static int connection_id(Connection* connection) {
+  if (connection->stream.state.fd == -1) {
+    return -1 - pool_index(&connection->server->connections, connection);
+  }
   return connection->stream.state.fd;
 }
 
-int server_init(Server* server, const char* ip, unsigned short port) {
+// Lobby ids are unique across all workers: id = index * n_workers + worker
+static int server_lobby_id(Server* server, Lobby* lobby) {
+  return pool_index(&server->lobbies, lobby) * server->config.workers + server->id;
+}
+
+// returns: worker which owns lobby with |id|
+static Server* server_lobby_worker(Server* server, int id) {
+  return &server->workers[id % server->config.workers];
+}
+
+void server_config_init(ServerConfig* config) {
+  config->host = "127.0.0.1";
+  config->port = 1337;
+  config->backend = REACTOR_BACKEND_EPOLL;
+  config->workers = 1;
+  config->idle_timeout_ms = 0;
+  config->busy_poll_us = 0;
+  config->read_budget_bytes = 4 * NET_BUFFER_SIZE;
+  config->read_budget_messages = 64;
+  config->max_buffer_size = NET_BUFFER_MAX_SIZE;
+  config->timestamping = false;
+  config->accept_backlog = 128;
+  config->accept_budget = 16;
+  config->max_connections = DEFAULT_MAX_CONNECTIONS;
+  config->max_lobbies = DEFAULT_MAX_LOBBIES;
+  config->simulation_threads = 0;
+  config->restart_socket = NULL;
+}
+
+// Free I/O blocks a worker keeps cached, a flush cycles a block through the dirty connections one by one,
+// so a few cover the steady state, blocks freed after a burst go back to malloc() instead
+static const int MAX_CACHED_BLOCKS = 64;
+
+// Everything but the listener, which is either created or restored
+static int server_init_worker(Server* server, const ServerConfig* config, int id, Server* workers) {
+  server->config = *config;
+  server->id = id;
+  server->workers = workers;
   atomic_store(&server->running, false);
 
-  if (reactor_init(&server->reactor) == -1) {
+  if (reactor_init_backend(&server->reactor, config->backend) == -1) {
     LOG_ERROR("Failed to initialize reactor: %s", strerror(errno));
     return -1;
   }
 
-  if (tcp_listener_init(&server->listener, &server->reactor, ip, port) == -1) {
-    LOG_ERROR("Failed to initialize tcp listener: %s", strerror(errno));
+  // only the first worker takes restart requests, it stops the others
+  server->restart_listener = (Evented){.fd = -1, .events = 0};
+  server->successor = -1;
+  server->restored = false;
+  if (id == 0 && config->restart_socket != NULL) {
+    server->restart_listener.fd = unix_listen(config->restart_socket);
+    if (server->restart_listener.fd == -1) {
+      LOG_ERROR("Failed to listen on restart socket %s: %s", config->restart_socket, strerror(errno));
+      return -1;
+    }
+  }
+
+  if (pool_init(&server->connections, sizeof(Connection), alignof(Connection), config->max_connections) == -1 ||
+      pool_init(&server->lobbies, sizeof(Lobby), alignof(Lobby), config->max_lobbies) == -1 ||
+      pool_init(&server->sessions, sizeof(Session), alignof(Session), config->max_connections) == -1) {
+    LOG_ERROR("Failed to reserve memory for %d connections and %d lobbies: %s",
+              config->max_connections, config->max_lobbies, strerror(errno));
+    return -1;
+  }
+  server->n_active_lobbies = 0;
+  server->active_lobbies = malloc(config->max_lobbies * sizeof(Lobby*));
+  if (server->active_lobbies == NULL) {
+    LOG_ERROR("Failed to allocate %d lobbies: out of memory", config->max_lobbies);
+    return -1;
+  }
+
+  if (simulation_pool_init(&server->simulation, config->simulation_threads) == -1) {
+    LOG_ERROR("Failed to start %d simulation threads: %s", config->simulation_threads, strerror(errno));
     return -1;
   }
 
-  pool_init(
-    &server->connections,
-    server->connections_memory, sizeof(server->connections_memory),
-    sizeof(Connection), alignof(Connection)
-  );
-  pool_init(
-    &server->lobbies,
-    server->lobbies_memory, sizeof(server->lobbies_memory),
-    sizeof(Lobby), alignof(Lobby)
-  );
+  buffer_pool_init(&server->buffers, NET_BUFFER_SIZE, MAX_CACHED_BLOCKS);
 
   int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
 
   server->timer = (Evented){.fd = timer, .events = 0};
-  LOG_INFO("Max connections: %d", pool_capacity(&server->connections));
-  LOG_INFO("Max lobbies:     %d", pool_capacity(&server->lobbies));
+  server->tick_due = false;
+  server->dirty = NULL;
+  server->tick_start_ns = 0;
+  server->ticks = 0;
+  server->simulated_ticks = 0;
+
+  server->spin_window_us = config->busy_poll_us;
+  server->spinning = false;
+  memset(server->tick_latency, 0, sizeof(server->tick_latency));
+  memset(&server->stats, 0, sizeof(server->stats));
+  server->sample_cursor = 0;
+  if (tcp_listen_overflows(&server->listen_overflows, &server->listen_drops) == -1) {
+    server->listen_overflows = 0;
+    server->listen_drops = 0;
+  }
+  atomic_store(&server->stats_requested, false);
+
+  if (id == 0) {
+    LOG_INFO("IO backend:      %s", config->backend == REACTOR_BACKEND_IO_URING ? "io_uring" : "epoll");
+    LOG_INFO("Workers:         %d", config->workers);
+    if (config->busy_poll_us > 0) {
+      LOG_INFO("Busy poll:       %d us", config->busy_poll_us);
+    }
+    if (config->timestamping) {
+      LOG_INFO("Timestamping:    on");
+    }
+    if (config->simulation_threads > 0) {
+      LOG_INFO("Simulation:      %d threads per worker", config->simulation_threads);
+    }
+    LOG_INFO("Accept:          backlog %d, %d per wake", config->accept_backlog, config->accept_budget);
+    LOG_INFO("Max connections: %d", pool_capacity(&server->connections) * config->workers);
+    LOG_INFO("Max lobbies:     %d", pool_capacity(&server->lobbies) * config->workers);
+    if (config->restart_socket != NULL) {
+      LOG_INFO("Restart socket:  %s", config->restart_socket);
+    }
+  }
+  return 0;
+}
+
+int server_init(Server* server, const ServerConfig* config, int id, Server* workers) {
+  if (server_init_worker(server, config, id, workers) == -1) {
+    return -1;
+  }
+
+  unsigned listener_flags = config->workers > 1 ? TCP_LISTENER_REUSEPORT : 0;
+  if (tcp_listener_init(&server->listener, &server->reactor, config->host, config->port,
+                        config->accept_backlog, listener_flags) == -1) {
+    LOG_ERROR("Failed to initialize tcp listener: %s", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+// Period of the server timer, every tick advances all active games by this fixed timestep
+static const int TICK_INTERVAL_MS = 16;
+// A late tick stage catches up on at most this many missed ticks, the rest are skipped,
+// so an overloaded worker slows its games down instead of falling further and further behind
+static const int MAX_CATCH_UP_TICKS = 4;
+
+static void server_connection_idle(void* context);
+static int server_connection_event(void* context, unsigned events);
+
+// Start (or restart) idle timeout of |connection|
+static void server_touch(Server* server, Connection* connection) {
+  if (server->config.idle_timeout_ms > 0) {
+    reactor_schedule(&server->reactor, &connection->idle_timer, server->config.idle_timeout_ms);
+  }
+}
+
+// Start IO of a new |connection| whose stream is set up
+// returns: -1 on error (the stream is closed then), 0 otherwise
+static int server_start_connection(Server* server, Connection* connection) {
+  if (tcp_start_recv(&connection->stream) == -1 || tcp_set_eager_send(&connection->stream) == -1) {
+    LOG_WARN("Failed to start read opertion on accepted socket: %s", strerror(errno));
+    tcp_close(&connection->stream);
+    return -1;
+  }
+
+  tcp_set_buffer_pool(&connection->stream, &server->buffers);
+  tcp_set_max_buffer_size(&connection->stream, server->config.max_buffer_size, server->config.max_buffer_size);
+  if (server->config.busy_poll_us > 0 && tcp_set_busy_poll(&connection->stream, server->config.busy_poll_us) == -1) {
+    LOG_DEBUG("[%02d] Failed to enable busy polling: %s", connection_id(connection), strerror(errno));
+  }
+
+  if (server->config.timestamping && tcp_set_timestamping(&connection->stream) == -1) {
+    LOG_DEBUG("[%02d] Failed to enable timestamping: %s", connection_id(connection), strerror(errno));
+  }
+
+  connection->lobby = NULL;
+  connection->server = server;
+  connection->dirty = false;
+  connection->session = NULL;
+  evented_set_handler(&connection->stream.state, server_connection_event, connection);
+  evented_set_stats(&connection->stream.state, &server->stats.connection_ns);
+  timer_init(&connection->idle_timer, server_connection_idle, connection);
+  server_touch(server, connection);
   return 0;
 }
 
 static int server_accept(Server* server) {
-  while (true) {
+  TcpListenerInfo info;
+  if (tcp_listener_get_info(&server->listener, &info) == 0) {
+    histogram_add(&server->stats.accept_queue, info.queued);
+    if (info.queued >= info.backlog) {
+      server->stats.accept_queue_full++;
+    }
+  }
+
+  for (int budget = server->config.accept_budget; ; --budget) {
+    if (budget == 0) {
+      // the listener won't report the rest again, so the reactor has to
+      server->stats.accept_yields++;
+      reactor_defer(&server->reactor, &server->listener.state, IO_EVENT_READ);
+      return 0;
+    }
+
     Connection* connection = pool_aquire(&server->connections);
     if (connection == NULL) {
       LOG_WARN("Could not accept connection: the connection pool is full");
@@ -65,40 +249,228 @@ static int server_accept(Server* server) {
       return n;
     }
 
-    if (tcp_start_recv(&connection->stream) == -1) {
-      LOG_WARN("Failed to start read opertion on accepted socket: %s", strerror(errno));
-      tcp_close(&connection->stream);
+    if (server_start_connection(server, connection) == -1) {
       pool_release(&server->connections, connection);
       return -1;
     }
 
-    connection->lobby = NULL;
     LOG_INFO("[%02d] Client successfully connected", connection_id(connection));
   }
 }
 
-static int send_message(Connection* connection, ServerMessage* message) {
-  char buffer[MAX_MESSAGE_SIZE];
-  int n = server_message_write(message, buffer, sizeof(buffer));
+// Cork |connection| and queue it to be flushed at the end of the loop iteration
+static void server_mark_dirty(Server* server, Connection* connection) {
+  if (connection->dirty) {
+    return;
+  }
+
+  tcp_cork(&connection->stream);
+  connection->backlog = tcp_pending(&connection->stream);
+  connection->dirty = true;
+  connection->dirty_prev = NULL;
+  connection->dirty_next = server->dirty;
+  if (server->dirty != NULL) {
+    server->dirty->dirty_prev = connection;
+  }
+  server->dirty = connection;
+}
+
+static void server_unmark_dirty(Server* server, Connection* connection) {
+  if (!connection->dirty) {
+    return;
+  }
+
+  if (connection->dirty_prev != NULL) {
+    connection->dirty_prev->dirty_next = connection->dirty_next;
+  }
+  else {
+    server->dirty = connection->dirty_next;
+  }
+
+  if (connection->dirty_next != NULL) {
+    connection->dirty_next->dirty_prev = connection->dirty_prev;
+  }
+  connection->dirty = false;
+}
+
+// Serialize |message| to the output of |connection|
+static int queue_message(Connection* connection, ServerMessage* message) {
+  // the message is serialized right into the output buffer, unless the queued output leaves no room there
+  char scratch[MAX_PACKET_SIZE];
+  char* reserved = tcp_reserve(&connection->stream, MAX_PACKET_SIZE);
+  char* buffer = reserved != NULL ? reserved : scratch;
+  int n = server_message_write(message, buffer, MAX_PACKET_SIZE);
   if (n == 0) {
     LOG_WARN("[%02d] Failed to serialize message", connection_id(connection));
     return -1;
   }
 
-  n = tcp_start_send(&connection->stream, buffer, n);
-  if (n == 0) {
+  int status = reserved != NULL ? tcp_commit(&connection->stream, n) : tcp_start_send(&connection->stream, scratch, n);
+  if (status == -1) {
+    LOG_WARN("[%02d] Failed to send message: %s", connection_id(connection), strerror(errno));
+    return -1;
+  }
+
+  if (reserved == NULL && status == 0) {
     LOG_WARN("[%02d] Failed to send message: output buffer is at capacity", connection_id(connection));
     return -1;
   }
 
-  if (n == -1) {
-    LOG_WARN("[%02d] Failed to send message: %s", strerror(errno));
+  return 0;
+}
+
+// Messages are only buffered, they are sent at once by server_flush()
+static int send_message(Connection* connection, ServerMessage* message) {
+  server_mark_dirty(connection->server, connection);
+  Session* session = connection->session;
+  if (session == NULL) {
+    return queue_message(connection, message);
+  }
+
+  if (message->id == SERVER_UPDATE) {
+    if (session->has_update) {
+      connection->server->stats.coalesced_updates++;
+    }
+
+    session->update = message->server_update;
+    session->has_update = true;
+    return 0;
+  }
+
+  // other messages go ahead of the lanes, so an update or a spectator frame still there would arrive
+  // after them, e.g. a paddle update after GAME_STATE_UPDATE, the next tick brings a fresh one anyway
+  if (session->has_update) {
+    session->has_update = false;
+    connection->server->stats.coalesced_updates++;
+  }
+
+  if (session->frame != NULL) {
+    shared_buffer_unref(session->frame);
+    session->frame = NULL;
+    connection->server->stats.coalesced_updates++;
+  }
+  return queue_message(connection, message);
+}
+
+// requires: |spectator| has a session
+static void lobby_add_spectator(Lobby* lobby, Connection* spectator) {
+  Session* session = spectator->session;
+  session->spectating = lobby;
+  session->spectator_prev = NULL;
+  session->spectator_next = lobby->spectators;
+  if (lobby->spectators != NULL) {
+    lobby->spectators->session->spectator_prev = spectator;
+  }
+  lobby->spectators = spectator;
+  lobby->n_spectators++;
+}
+
+// Detach |spectator| from the lobby it watches and drop the frame it has not sent yet
+static void lobby_remove_spectator(Connection* spectator) {
+  Session* session = spectator->session;
+  if (session == NULL || session->spectating == NULL) {
+    return;
+  }
+
+  Lobby* lobby = session->spectating;
+  if (session->spectator_prev != NULL) {
+    session->spectator_prev->session->spectator_next = session->spectator_next;
+  }
+  else {
+    lobby->spectators = session->spectator_next;
+  }
+
+  if (session->spectator_next != NULL) {
+    session->spectator_next->session->spectator_prev = session->spectator_prev;
+  }
+  lobby->n_spectators--;
+  session->spectating = NULL;
+
+  if (session->frame != NULL) {
+    shared_buffer_unref(session->frame);
+    session->frame = NULL;
+  }
+}
+
+// Give |connection| a session for the lobby it enters, unless it has one already
+// returns: -1 if out of memory, 0 otherwise
+static int server_attach_session(Server* server, Connection* connection) {
+  if (connection->session != NULL) {
+    return 0;
+  }
+
+  Session* session = pool_aquire(&server->sessions);
+  if (session == NULL) {
+    return -1;
+  }
+
+  session->has_update = false;
+  session->spectating = NULL;
+  session->frame = NULL;
+  session->has_info = false;
+  session->input_rx_ns = 0;
+  session->input_read_ns = 0;
+  session->output_tick_ns = 0;
+  session->output_end = 0;
+  connection->session = session;
+  return 0;
+}
+
+// Take the session of |connection| back once it has left its lobby, lanes which are not sent yet are dropped
+static void server_release_session(Server* server, Connection* connection) {
+  if (connection->session == NULL) {
+    return;
+  }
+
+  lobby_remove_spectator(connection);
+  pool_release(&server->sessions, connection->session);
+  connection->session = NULL;
+}
+
+// Serialize |update| once and put it into the lane of every spectator of |lobby|,
+// the spectators share the buffer instead of getting a copy each
+static int lobby_broadcast_frame(Lobby* lobby, const ServerUpdate* update) {
+  Server* server = lobby->owner->server;
+  SharedBuffer* frame = shared_buffer_create(MAX_PACKET_SIZE);
+  if (frame == NULL) {
+    LOG_WARN("Failed to encode frame: out of memory");
+    return -1;
+  }
+
+  ServerMessage message;
+  message.id = SERVER_UPDATE;
+  message.server_update = *update;
+  frame->size = server_message_write(&message, frame->data, MAX_PACKET_SIZE);
+  if (frame->size == 0) {
+    LOG_WARN("Failed to serialize frame");
+    shared_buffer_unref(frame);
     return -1;
   }
 
+  server->stats.frames_encoded++;
+  for (Connection* spectator = lobby->spectators; spectator != NULL; spectator = spectator->session->spectator_next) {
+    server_mark_dirty(server, spectator);
+    Session* session = spectator->session;
+    if (session->frame != NULL) {
+      server->stats.coalesced_updates++;
+      shared_buffer_unref(session->frame);
+    }
+    session->frame = shared_buffer_ref(frame);
+  }
+
+  shared_buffer_unref(frame);
   return 0;
 }
 
+// Send |message| to every spectator of |lobby| one by one, for messages which are too rare to share
+static void lobby_notify_spectators(Lobby* lobby, ServerMessage* message) {
+  for (Connection* spectator = lobby->spectators; spectator != NULL; spectator = spectator->session->spectator_next) {
+    if (send_message(spectator, message) < 0) {
+      LOG_WARN("[%02d] Failed to notify spectator", connection_id(spectator));
+    }
+  }
+}
+
 static int send_error(Connection* connection, int error) {
   ServerMessage message;
   message.id = ERROR_STATUS;
@@ -109,48 +481,99 @@ static int send_error(Connection* connection, int error) {
 static void lobby_init(Lobby* lobby, Connection* owner, const char* password) {
   lobby->owner = owner;
   lobby->guest = NULL;
+  lobby->active_index = -1;
+  lobby->spectators = NULL;
+  lobby->n_spectators = 0;
+  lobby->slow = false;
   strcpy(lobby->password, password);
   game_init(&lobby->game, true);
 }
 
+// Add |lobby| to the dense set of lobbies with a running game, only those are ticked
+static void server_activate_lobby(Server* server, Lobby* lobby) {
+  if (lobby->active_index != -1) {
+    return;
+  }
+
+  lobby->active_index = server->n_active_lobbies;
+  server->active_lobbies[server->n_active_lobbies++] = lobby;
+}
+
+// Remove |lobby| from the set, the last lobby of the set takes its place
+static void server_deactivate_lobby(Server* server, Lobby* lobby) {
+  if (lobby->active_index == -1) {
+    return;
+  }
+
+  Lobby* last = server->active_lobbies[--server->n_active_lobbies];
+  server->active_lobbies[lobby->active_index] = last;
+  last->active_index = lobby->active_index;
+  lobby->active_index = -1;
+}
+
 static int server_create_lobby(Server* server, Connection* owner, CreateLobby* message) {
   if (owner->lobby != NULL) {
-    int lobby_id = pool_index(&server->lobbies, owner->lobby);
-    LOG_INFO("[%02d] Failed to create game lobby: client already in lobby #%d", connection_id(owner), lobby_id);
+    LOG_INFO("[%02d] Failed to create game lobby: client already in lobby #%d",
+             connection_id(owner), server_lobby_id(server, owner->lobby));
     // TODO: disconnect from current lobby and create a new one instead?
     return send_error(owner, INTERNAL_ERROR);
   }
 
   Lobby* lobby = pool_aquire(&server->lobbies);
-  if (lobby == NULL) {
+  if (lobby == NULL || server_attach_session(server, owner) == -1) {
     LOG_ERROR("[%02d] Failed to create new lobby: out of memory", connection_id(owner));
+    if (lobby != NULL) {
+      pool_release(&server->lobbies, lobby);
+    }
     return send_error(owner, INTERNAL_ERROR);
   }
 
+  // a spectator becomes a player
+  lobby_remove_spectator(owner);
   lobby_init(lobby, owner, message->password);
   owner->lobby = lobby;
 
-  int lobby_id = pool_index(&server->lobbies, lobby);
-  LOG_INFO("[%02d] Created lobby #%d with password \"%s\"", connection_id(owner), lobby_id, lobby->password);
+  int id = server_lobby_id(server, lobby);
+  LOG_INFO("[%02d] Created lobby #%d with password \"%s\"", connection_id(owner), id, lobby->password);
 
   ServerMessage response;
   response.id = LOBBY_CREATED;
-  response.lobby_created.id = lobby_id;
+  response.lobby_created.id = id;
   return send_message(owner, &response);
 }
 
-static int process_active_lobby(Lobby* lobby, int id) {
-  if (!lobby->owner || !lobby->guest) {
-    return 0;
+// Advance the game of |lobby| by |steps| fixed timesteps and take snapshots of it for both players
+// Touches nothing but |lobby|, so lobbies are simulated in parallel (see server_process_active_lobbies())
+static void lobby_simulate(Lobby* lobby, int steps) {
+  // TODO: get rid of TICK_INTERVAL_MS after game_step_end refactoring
+  for (int i = 0; i < steps && lobby->game.state == STATE_RUNNING; ++i) {
+    game_step_end(&lobby->game, TICK_INTERVAL_MS);
   }
 
-  if (lobby->game.state != STATE_RUNNING) {
-    return 0;
-  }
+  // the guest sees the board upside down
+  ServerUpdate* update = &lobby->guest_update;
+  update->player_position.x = lobby->game.opponent.bbox.position.x;
+  update->player_position.y = -lobby->game.opponent.bbox.position.y - lobby->game.opponent.bbox.size.y;
+
+  update->ball_position.x = lobby->game.ball.bbox.position.x;
+  update->ball_position.y = -lobby->game.ball.bbox.position.y - lobby->game.ball.bbox.size.y;
+
+  update->opponent_position.x = lobby->game.player.bbox.position.x;
+  update->opponent_position.y = -lobby->game.player.bbox.position.y - lobby->game.player.bbox.size.y;
 
-  // TODO: get rid of 16 after game_step_end refactoring
-  game_step_end(&lobby->game, 16);
+  update = &lobby->owner_update;
+  update->player_position.x = lobby->game.player.bbox.position.x;
+  update->player_position.y = lobby->game.player.bbox.position.y;
 
+  update->ball_position.x = lobby->game.ball.bbox.position.x;
+  update->ball_position.y = lobby->game.ball.bbox.position.y;
+
+  update->opponent_position.x = lobby->game.opponent.bbox.position.x;
+  update->opponent_position.y = lobby->game.opponent.bbox.position.y;
+}
+
+// Send the players of |lobby| the outcome of its latest simulation
+static int lobby_publish(Lobby* lobby, int id) {
   if (lobby->game.state == STATE_LOST || lobby->game.state == STATE_WON) {
     const char* state = lobby->game.state == STATE_LOST ? "lost" : "won";
 
@@ -170,60 +593,230 @@ static int process_active_lobby(Lobby* lobby, int id) {
       return -1;
     }
 
+    msg.game_state_update.state = lobby->game.state;
+    lobby_notify_spectators(lobby, &msg);
     return 0;
   }
 
   ServerMessage response;
-
   response.id = SERVER_UPDATE;
 
   // send to opponent
-  response.server_update.player_position.x = lobby->game.opponent.bbox.position.x;
-  response.server_update.player_position.y = -lobby->game.opponent.bbox.position.y - lobby->game.opponent.bbox.size.y;
-
-  response.server_update.ball_position.x = lobby->game.ball.bbox.position.x;
-  response.server_update.ball_position.y = -lobby->game.ball.bbox.position.y - lobby->game.ball.bbox.size.y;
-
-  response.server_update.opponent_position.x = lobby->game.player.bbox.position.x;
-  response.server_update.opponent_position.y = -lobby->game.player.bbox.position.y - lobby->game.player.bbox.size.y;
-
+  response.server_update = lobby->guest_update;
   if (send_message(lobby->guest, &response) < 0) {
     return -1;
   }
 
   // send to player
-  response.server_update.player_position.x = lobby->game.player.bbox.position.x;
-  response.server_update.player_position.y = lobby->game.player.bbox.position.y;
-
-  response.server_update.ball_position.x = lobby->game.ball.bbox.position.x;
-  response.server_update.ball_position.y = lobby->game.ball.bbox.position.y;
-
-  response.server_update.opponent_position.x = lobby->game.opponent.bbox.position.x;
-  response.server_update.opponent_position.y = lobby->game.opponent.bbox.position.y;
-
+  response.server_update = lobby->owner_update;
   if (send_message(lobby->owner, &response) < 0) {
     return -1;
   }
 
+  if (lobby->n_spectators > 0) {
+    return lobby_broadcast_frame(lobby, &lobby->owner_update);
+  }
+
   return 0;
 }
 
-static int server_process_active_lobbies(Server* server) {
-  for (Lobby* lobby = pool_first(&server->lobbies); lobby != NULL; lobby = pool_next(&server->lobbies, lobby)) {
+// |player| is ticked at |now|: account for the time its input has waited,
+// the SERVER_UPDATE of this tick is tracked till it's transmitted
+static void server_track_input(Server* server, Connection* player, uint64_t now) {
+  if (player == NULL || player->session->input_read_ns == 0) {
+    return;
+  }
+
+  Session* session = player->session;
+  if (session->input_rx_ns != 0 && session->input_rx_ns <= session->input_read_ns) {
+    histogram_add(&server->stats.input_kernel_ns, session->input_read_ns - session->input_rx_ns);
+  }
+  histogram_add(&server->stats.input_tick_ns, now - session->input_read_ns);
+  session->input_rx_ns = 0;
+  session->input_read_ns = 0;
+
+  // an older update still on its way keeps the slot, one in flight is enough for sampling
+  if (session->output_tick_ns == 0) {
+    session->output_tick_ns = now;
+    session->output_end = 0;
+  }
+}
+
+// Account for the output latency of |connection| once its tracked SERVER_UPDATE is transmitted
+static void server_track_output(Server* server, Connection* connection) {
+  TcpStream* stream = &connection->stream;
+  Session* session = connection->session;
+  if (session == NULL || session->output_end == 0 || stream->tx_bytes < session->output_end) {
+    return;
+  }
+
+  if (stream->tx_ns >= session->output_tick_ns) {
+    histogram_add(&server->stats.output_queue_ns, stream->tx_ns - session->output_tick_ns);
+  }
+  session->output_tick_ns = 0;
+  session->output_end = 0;
+}
+
+// A tick with fewer active lobbies is simulated on the network thread alone,
+// waking the simulation threads would cost more than stepping the games
+static const int PARALLEL_SIMULATION_MIN_LOBBIES = 64;
+
+typedef struct {
+  Lobby** lobbies;
+  int steps;
+} SimulationBatch;
+
+static void server_simulate_lobby(void* context, int index) {
+  SimulationBatch* batch = context;
+  lobby_simulate(batch->lobbies[index], batch->steps);
+}
 
-    int lobby_id = pool_index(&server->lobbies, lobby);
-    if (process_active_lobby(lobby, lobby_id) < 0) {
-      LOG_WARN("Failed to update lobby with #%d", lobby_id);
+// Tick in stages: simulate lobbies with a running game in parallel,
+// then (once all of them are done) send the snapshots from the network thread
+// The cost depends on the number of running games only, idle lobbies are not in |active_lobbies|
+static int server_process_active_lobbies(Server* server, int steps) {
+  int n = server->n_active_lobbies;
+  if (server->config.timestamping) {
+    uint64_t now = clock_now_ns();
+    for (int i = 0; i < n; ++i) {
+      server_track_input(server, server->active_lobbies[i]->owner, now);
+      server_track_input(server, server->active_lobbies[i]->guest, now);
+    }
+  }
+
+  uint64_t start = clock_now_ns();
+  SimulationBatch batch = {.lobbies = server->active_lobbies, .steps = steps};
+  if (n >= PARALLEL_SIMULATION_MIN_LOBBIES) {
+    simulation_pool_run(&server->simulation, n, server_simulate_lobby, &batch);
+  }
+  else {
+    for (int i = 0; i < n; ++i) {
+      server_simulate_lobby(&batch, i);
+    }
+  }
+  histogram_add(&server->stats.simulate_ns, clock_now_ns() - start);
+
+  // backwards, so the lobby which takes the place of a finished one is published already
+  for (int i = n - 1; i >= 0; --i) {
+    Lobby* lobby = server->active_lobbies[i];
+    int id = server_lobby_id(server, lobby);
+    if (lobby_publish(lobby, id) < 0) {
+      LOG_WARN("Failed to update lobby with #%d", id);
+    }
+
+    if (lobby->game.state != STATE_RUNNING) {
+      server_deactivate_lobby(server, lobby);
     }
   }
 
   return 0;
+}
+
+// Every connection in a lobby is sampled at least once per this many ticks (about a second),
+// the samples are spread over the ticks, so a tick pays for a few getsockopt() calls at most
+#define TCP_INFO_INTERVAL_TICKS 64
+// A lobby is slow if a player's rtt exceeds this or the player has retransmits since the last sample
+static const uint32_t SLOW_RTT_US = 100 * 1000;
+
+static bool connection_is_slow(Connection* connection) {
+  return connection != NULL && connection->session->has_info &&
+         (connection->session->info.rtt_us > SLOW_RTT_US || connection->session->new_retransmits > 0);
+}
+
+// Flag |lobby| as slow or not, so lag is attributed to the network rather than the server
+static void server_check_lobby(Server* server, Lobby* lobby) {
+  bool slow = connection_is_slow(lobby->owner) || connection_is_slow(lobby->guest);
+  if (slow == lobby->slow) {
+    return;
+  }
+
+  lobby->slow = slow;
+  int id = server_lobby_id(server, lobby);
+  if (slow) {
+    Connection* player = connection_is_slow(lobby->owner) ? lobby->owner : lobby->guest;
+    const Session* session = player->session;
+    LOG_WARN("Lobby #%d is slow: [%02d] rtt %u us, %u new retransmits, %u unacked bytes",
+             id, connection_id(player), session->info.rtt_us, session->new_retransmits, session->info.unacked_bytes);
+  }
+  else {
+    LOG_INFO("Lobby #%d is no longer slow", id);
+  }
+}
+
+// The sample is kept in the session, connections which are not in a lobby are not sampled
+static void server_sample_connection(Server* server, Connection* connection) {
+  Session* session = connection->session;
+  TcpInfo info;
+  if (session == NULL || tcp_get_info(&connection->stream, &info) == -1) {
+    return;
+  }
+
+  session->new_retransmits = session->has_info ? info.retransmits - session->info.retransmits : 0;
+  session->info = info;
+  session->has_info = true;
+  histogram_add(&server->stats.rtt_us, info.rtt_us);
+  server->stats.retransmits += session->new_retransmits;
+
+  if (connection->lobby != NULL) {
+    server_check_lobby(server, connection->lobby);
+  }
+}
+
+// Sample TCP_INFO of the next slice of the connection pool
+static void server_sample_connections(Server* server) {
+  // slots beyond the committed ones are empty
+  int committed = pool_committed(&server->connections);
+  int n = (committed + TCP_INFO_INTERVAL_TICKS - 1) / TCP_INFO_INTERVAL_TICKS;
+  for (int i = 0; i < n; ++i) {
+    server->sample_cursor = server->sample_cursor < committed ? server->sample_cursor : 0;
+    Connection* connection = pool_at(&server->connections, server->sample_cursor);
+    server->sample_cursor++;
+    if (pool_contains(&server->connections, connection)) {
+      server_sample_connection(server, connection);
+    }
+  }
+}
+
+static int server_handoff(Server* server, Connection* connection, Server* target);
+
+// The lobby lives on the worker of its owner, so a client which enters it has to move there
+// The message which caused the move stays in the input buffer, it's processed by the new owner
+// returns: -1 on error, CONNECTION_MOVED once |connection| is handed over,
+//          or the status of the error sent to |connection| if it can't move
+static int server_move_to_lobby(Server* server, Connection* connection, int lobby_id) {
+  if (connection->lobby != NULL) {
+    LOG_WARN("[%02d] Failed to enter lobby #%d: client already in lobby #%d",
+             connection_id(connection), lobby_id, server_lobby_id(server, connection->lobby));
+    return send_error(connection, INTERNAL_ERROR);
+  }
 
+  // in-process transports are bound to the reactor of this worker
+  if (!connection->stream.transport->movable) {
+    LOG_WARN("[%02d] Failed to enter lobby #%d: %s transport can't move to worker #%d", connection_id(connection),
+             lobby_id, connection->stream.transport->name, server_lobby_worker(server, lobby_id)->id);
+    return send_error(connection, INTERNAL_ERROR);
+  }
+
+  // lobbies, frames and sessions of this worker stay here
+  server_release_session(server, connection);
+  if (server_handoff(server, connection, server_lobby_worker(server, lobby_id)) == -1) {
+    return -1;
+  }
+  return CONNECTION_MOVED;
 }
 
 static int server_join_lobby(Server* server, Connection* guest, JoinLobby* message) {
   int lobby_id = message->id;
-  Lobby* lobby = pool_at(&server->lobbies, lobby_id);
+  if (lobby_id < 0) {
+    LOG_WARN("[%02d] Tried to join to invalid lobby #%d", connection_id(guest), lobby_id);
+    return send_error(guest, INVALID_LOBBY_ID);
+  }
+
+  if (server_lobby_worker(server, lobby_id) != server) {
+    return server_move_to_lobby(server, guest, lobby_id);
+  }
+
+  Lobby* lobby = pool_at(&server->lobbies, lobby_id / server->config.workers);
   if (!pool_contains(&server->lobbies, lobby)) {
     LOG_WARN("[%02d] Tried to join to invalid lobby #%d", connection_id(guest), lobby_id);
     return send_error(guest, INVALID_LOBBY_ID);
@@ -239,8 +832,16 @@ static int server_join_lobby(Server* server, Connection* guest, JoinLobby* messa
     return send_error(guest, INVALID_PASSWORD);
   }
 
+  if (server_attach_session(server, guest) == -1) {
+    LOG_ERROR("[%02d] Failed to join lobby #%d: out of memory", connection_id(guest), lobby_id);
+    return send_error(guest, INTERNAL_ERROR);
+  }
+
+  // a spectator becomes a player
+  lobby_remove_spectator(guest);
   lobby->guest = guest;
   guest->lobby = lobby;
+  server_activate_lobby(server, lobby);
 
   Connection* owner = lobby->owner;
 
@@ -256,6 +857,51 @@ static int server_join_lobby(Server* server, Connection* guest, JoinLobby* messa
   return send_message(owner, &response);
 }
 
+static int server_spectate_lobby(Server* server, Connection* spectator, SpectateLobby* message) {
+  int lobby_id = message->id;
+  if (lobby_id < 0) {
+    LOG_WARN("[%02d] Tried to spectate invalid lobby #%d", connection_id(spectator), lobby_id);
+    return send_error(spectator, INVALID_LOBBY_ID);
+  }
+
+  if (spectator->lobby != NULL) {
+    LOG_WARN("[%02d] Failed to spectate lobby #%d: client plays in lobby #%d",
+             connection_id(spectator), lobby_id, server_lobby_id(server, spectator->lobby));
+    return send_error(spectator, INTERNAL_ERROR);
+  }
+
+  if (server_lobby_worker(server, lobby_id) != server) {
+    return server_move_to_lobby(server, spectator, lobby_id);
+  }
+
+  Lobby* lobby = pool_at(&server->lobbies, lobby_id / server->config.workers);
+  if (!pool_contains(&server->lobbies, lobby)) {
+    LOG_WARN("[%02d] Tried to spectate invalid lobby #%d", connection_id(spectator), lobby_id);
+    return send_error(spectator, INVALID_LOBBY_ID);
+  }
+
+  if (strcmp(lobby->password, message->password)) {
+    LOG_WARN("[%02d] Failed to spectate lobby #%d: invalid password: %s",
+             connection_id(spectator), lobby_id, message->password);
+    return send_error(spectator, INVALID_PASSWORD);
+  }
+
+  if (server_attach_session(server, spectator) == -1) {
+    LOG_ERROR("[%02d] Failed to spectate lobby #%d: out of memory", connection_id(spectator), lobby_id);
+    return send_error(spectator, INTERNAL_ERROR);
+  }
+
+  // a spectator could switch to another lobby
+  lobby_remove_spectator(spectator);
+  lobby_add_spectator(lobby, spectator);
+
+  ServerMessage response;
+  response.id = LOBBY_JOINED;
+  strcpy(response.lobby_joined.ipv4, inet_ntoa(lobby->owner->address.sin_addr));
+  LOG_INFO("[%02d] Spectating lobby #%d, %d spectators", connection_id(spectator), lobby_id, lobby->n_spectators);
+  return send_message(spectator, &response);
+}
+
 
 static int server_client_update(Server* server, Connection* player, ClientUpdate* message) {
   if (!pool_contains(&server->lobbies, player->lobby)) {
@@ -263,6 +909,12 @@ static int server_client_update(Server* server, Connection* player, ClientUpdate
     return send_error(player, INVALID_LOBBY_ID);
   }
 
+  // the first update waiting for the tick has waited the longest
+  if (server->config.timestamping && player->session->input_read_ns == 0) {
+    player->session->input_rx_ns = player->stream.rx_ns;
+    player->session->input_read_ns = clock_now_ns();
+  }
+
   if(player->lobby->owner == player) {
     player->lobby->game.player.speed = message->speed;
   }
@@ -275,7 +927,6 @@ static int server_client_update(Server* server, Connection* player, ClientUpdate
 
 static int server_client_state_update(Server* server, Connection* player,
                                       ClientStateUpdate* message) {
-  (void)server;
   switch (message->state) {
     case CLIENT_STATE_RESTART:
       if (player->lobby == NULL) {
@@ -288,6 +939,7 @@ static int server_client_state_update(Server* server, Connection* player,
 
       if (player->lobby->game.state != STATE_RUNNING) {
         game_event(&player->lobby->game, EVENT_RESTART);
+        server_activate_lobby(server, player->lobby);
         ServerMessage server_msg;
         server_msg.id = GAME_STATE_UPDATE;
         server_msg.game_state_update.state = STATE_RUNNING;
@@ -300,6 +952,8 @@ static int server_client_state_update(Server* server, Connection* player,
           return -1;
         }
 
+        lobby_notify_spectators(player->lobby, &server_msg);
+
       }
       break;
     default:
@@ -309,6 +963,7 @@ static int server_client_state_update(Server* server, Connection* player,
   return 0;
 }
 
+// returns: -1 on error, CONNECTION_MOVED if |connection| was handed over to another worker, 0 otherwise
 static int server_process_message(Server* server, Connection* connection, ClientMessage* message) {
   int status = 0;
   switch (message->id) {
@@ -318,6 +973,9 @@ static int server_process_message(Server* server, Connection* connection, Client
     case JOIN_LOBBY:
       status = server_join_lobby(server, connection, &message->join_lobby);
       break;
+    case SPECTATE_LOBBY:
+      status = server_spectate_lobby(server, connection, &message->spectate_lobby);
+      break;
     case CLIENT_UPDATE:
       status = server_client_update(server, connection, &message->client_update);
       break;
@@ -333,23 +991,77 @@ static int server_process_message(Server* server, Connection* connection, Client
   return status;
 }
 
-static int server_read(Server* server, Connection* connection) {
-  while (true) {
-    int n = tcp_recv(&connection->stream);
-    if (n == 0) {
-      return -1;
-    }
+// Append the latest update of |connection| to its output, unless the client is behind
+static void server_flush_update(Connection* connection) {
+  Session* session = connection->session;
+  if (session == NULL || !session->has_update || connection->backlog != 0) {
+    return;
+  }
 
-    if (n < 0) {
-      LOG_WARN("[%02d] Read operation failed: %s", connection_id(connection), strerror(errno));
-      return -1;
+  ServerMessage message;
+  message.id = SERVER_UPDATE;
+  message.server_update = session->update;
+  if (queue_message(connection, &message) == 0) {
+    session->has_update = false;
+    if (session->output_tick_ns != 0 && session->output_end == 0) {
+      session->output_end = tcp_output_end(&connection->stream);
     }
-
-    // parse messages
-    int total = 0;
-    while (true) {
+  }
+}
+
+// Send the frame of spectator |connection| right from the shared buffer, unless the client is behind
+// With eager send the socket takes it without a copy to the stream, only a tail the socket doesn't take is buffered
+// returns: -1 on error, 0 otherwise
+static int server_flush_frame(Server* server, Connection* connection) {
+  Session* session = connection->session;
+  if (session == NULL || session->frame == NULL || connection->dirty || tcp_pending(&connection->stream) != 0) {
+    return 0;
+  }
+
+  SharedBuffer* frame = session->frame;
+  int n = tcp_start_send(&connection->stream, frame->data, frame->size);
+  if (n == -1) {
+    return -1;
+  }
+
+  if (n == frame->size) {
+    session->frame = NULL;
+    shared_buffer_unref(frame);
+    server->stats.frames_sent++;
+  }
+  return 0;
+}
+
+// Send what the lanes of |connection| have held back, once the output it was behind is gone
+// Until then a value stays in its lane, so a fresher one replaces it while the client doesn't catch up,
+// and a dirty connection is flushed by server_flush()
+// returns: -1 on error, 0 otherwise
+static int server_flush_lanes(Server* server, Connection* connection) {
+  if (connection->dirty || tcp_pending(&connection->stream) != 0) {
+    return 0;
+  }
+
+  connection->backlog = 0;
+  server_flush_update(connection);
+  return server_flush_frame(server, connection);
+}
+
+// returns: -1 on error, CONNECTION_MOVED if |connection| was handed over to another worker, 0 otherwise
+static int server_read(Server* server, Connection* connection) {
+  server_touch(server, connection);
+  int budget_bytes = server->config.read_budget_bytes;
+  int budget_messages = server->config.read_budget_messages;
+  // the socket could have more data
+  bool more = true;
+  while (true) {
+    // buffered messages go first, so the input buffer only grows for a message which doesn't fit
+    while (budget_messages > 0) {
+      char scratch[MAX_PACKET_SIZE];
+      int available = tcp_received(&connection->stream);
+      available = available < MAX_PACKET_SIZE ? available : MAX_PACKET_SIZE;
+
       ClientMessage message;
-      int n = client_message_read(&message, connection->stream.input + total, connection->stream.received - total);
+      int n = client_message_read(&message, tcp_peek(&connection->stream, available, scratch), available);
       if (n < 0) {
         LOG_WARN("[%02d] Client sent invalid message", connection_id(connection));
         return -1;
@@ -359,28 +1071,54 @@ static int server_read(Server* server, Connection* connection) {
         break;
       }
 
-      if (server_process_message(server, connection, &message) == -1) {
+      int status = server_process_message(server, connection, &message);
+      if (status == -1) {
         return -1;
       }
 
-      total += n;
+      // |connection| belongs to another worker now, with the message still unread
+      if (status == CONNECTION_MOVED) {
+        return CONNECTION_MOVED;
+      }
+
+      tcp_consume(&connection->stream, n);
+      budget_messages--;
     }
 
-    bool more = connection->stream.received == sizeof(connection->stream.input);
-    tcp_consume(&connection->stream, total);
+    if (budget_bytes <= 0 || budget_messages <= 0) {
+      // the socket won't report the rest again, so the reactor has to
+      reactor_defer(&server->reactor, &connection->stream.state, IO_EVENT_READ);
+      break;
+    }
 
     if (!more) {
       break;
     }
+
+    int received = tcp_received(&connection->stream);
+    int n = tcp_recv(&connection->stream);
+    if (n == 0) {
+      return -1;
+    }
+
+    if (n < 0) {
+      LOG_WARN("[%02d] Read operation failed: %s", connection_id(connection), strerror(errno));
+      return -1;
+    }
+
+    budget_bytes -= tcp_received(&connection->stream) - received;
+    more = tcp_input_full(&connection->stream);
   }
 
   return 0;
 }
 
+// returns: -1 on error, CONNECTION_MOVED if |connection| was handed over to another worker, 0 otherwise
 static int server_event(Server* server, Connection* connection, unsigned int event) {
   if (event & IO_EVENT_READ) {
-    if (server_read(server, connection) < 0) {
-      return -1;
+    int status = server_read(server, connection);
+    if (status != 0) {
+      return status;
     }
   }
 
@@ -388,14 +1126,37 @@ static int server_event(Server* server, Connection* connection, unsigned int eve
     if (tcp_send(&connection->stream) < 0) {
       return -1;
     }
+
+    // a client which has caught up gets the update it was held back from
+    if (server_flush_lanes(server, connection) == -1) {
+      return -1;
+    }
   }
 
+  server_track_output(server, connection);
+
   return 0;
 }
 
+// Return |connection| to the pool and resume accept() operation if the pool was full
+static void server_release_connection(Server* server, Connection* connection) {
+  server_unmark_dirty(server, connection);
+  server_release_session(server, connection);
+  bool was_full = pool_size(&server->connections) == pool_capacity(&server->connections);
+  pool_release(&server->connections, connection);
+
+  if (was_full) {
+    if (tcp_listener_start_accept(&server->listener) == -1) {
+      LOG_ERROR("Failed to resume accept() operation: %s", strerror(errno));
+    }
+    LOG_INFO("Connection pool is no longer full. Starting to accept new clients.");
+  }
+}
+
 static void server_disconnect(Server* server, Connection* connection) {
+  lobby_remove_spectator(connection);
   if (connection->lobby) {
-    int lobby_id = pool_index(&server->lobbies, connection->lobby);
+    int lobby_id = server_lobby_id(server, connection->lobby);
 
     Connection* opponent = NULL;
     if (connection == connection->lobby->owner) {
@@ -411,116 +1172,871 @@ static void server_disconnect(Server* server, Connection* connection) {
 
     if (opponent) {
       opponent->lobby = NULL;
+      server_release_session(server, opponent);
       if (send_error(opponent, OPPONENT_DISCONNECTED) < 0) {
         LOG_WARN("[%02d] Failed to notify about opponent disconnection");
         server_disconnect(server, opponent);
       }
     }
 
+    // spectators are told the same as the opponent
+    while (connection->lobby->spectators != NULL) {
+      Connection* spectator = connection->lobby->spectators;
+      server_release_session(server, spectator);
+      if (send_error(spectator, OPPONENT_DISCONNECTED) < 0) {
+        LOG_WARN("[%02d] Failed to notify spectator about lobby closing", connection_id(spectator));
+        server_disconnect(server, spectator);
+      }
+    }
+
     LOG_INFO("Lobby #%d closed", lobby_id);
+    server_deactivate_lobby(server, connection->lobby);
     pool_release(&server->lobbies, connection->lobby);
   }
 
   LOG_INFO("[%02d] Disconnected", connection_id(connection));
+  reactor_cancel(&server->reactor, &connection->idle_timer);
   tcp_close(&connection->stream);
-  bool was_full = pool_size(&server->connections) == pool_capacity(&server->connections);
-  pool_release(&server->connections, connection);
+  server_release_connection(server, connection);
+}
 
-  if (was_full) {
-    if (tcp_listener_start_accept(&server->listener) == -1) {
-      LOG_ERROR("Failed to resume accept() operation: %s", strerror(errno));
+static void server_connection_idle(void* context) {
+  Connection* connection = context;
+  LOG_INFO("[%02d] Client has been idle for %d ms", connection_id(connection),
+           connection->server->config.idle_timeout_ms);
+  server_disconnect(connection->server, connection);
+}
+
+static void server_accept_handoff(void* context);
+
+static int server_handoff(Server* server, Connection* connection, Server* target) {
+  Handoff* handoff = malloc(sizeof(Handoff));
+  if (handoff == NULL) {
+    LOG_ERROR("[%02d] Failed to hand over connection: out of memory", connection_id(connection));
+    return -1;
+  }
+
+  if (reactor_deregister(&server->reactor, &connection->stream.state) == -1) {
+    LOG_ERROR("[%02d] Failed to hand over connection: %s", connection_id(connection), strerror(errno));
+    free(handoff);
+    return -1;
+  }
+
+  // timers are bound to the reactor of the worker
+  reactor_cancel(&server->reactor, &connection->idle_timer);
+  handoff->target = target;
+  handoff->connection = *connection;
+  int id = connection_id(connection);
+  server_release_connection(server, connection);
+
+  if (reactor_post(&target->reactor, server_accept_handoff, handoff) == -1) {
+    LOG_ERROR("[%02d] Failed to hand over connection: out of memory", id);
+    tcp_close(&handoff->connection.stream);
+    free(handoff);
+    // the connection is already gone, so it's not an error of the caller
+    return 0;
+  }
+
+  // |handoff| belongs to the target worker now, it may be freed already
+  LOG_DEBUG("[%02d] Handed over to worker #%d", id, target->id);
+  return 0;
+}
+
+// Close handed over |connection| which |server| has no room for, the client is told |error| first
+static void server_reject_handoff(Server* server, Connection* connection, int error) {
+  connection->server = server;
+  connection->stream.reactor = &server->reactor;
+  tcp_set_buffer_pool(&connection->stream, &server->buffers);
+
+  // the stream isn't registered with the reactor, so the output is written right away,
+  // as far as the socket takes it, with what the previous owner left ahead of the error
+  tcp_cork(&connection->stream);
+  ServerMessage message = {.id = ERROR_STATUS, .error.status = error};
+  if (queue_message(connection, &message) == 0) {
+    connection->stream.flags |= TCP_EAGER_SEND;
+    tcp_uncork(&connection->stream);
+  }
+  tcp_close(&connection->stream);
+}
+
+// Runs on the reactor thread of |handoff->target|
+static void server_accept_handoff(void* context) {
+  Handoff* handoff = context;
+  Server* server = handoff->target;
+  // a stopped worker adopts the connection too, it's dumped for a hot restart or closed with the rest
+  Connection* connection = pool_aquire(&server->connections);
+  if (connection == NULL) {
+    LOG_WARN("[%02d] Could not accept handed over connection: the connection pool is full",
+             connection_id(&handoff->connection));
+    server_reject_handoff(server, &handoff->connection, LOBBY_IS_FULL);
+    free(handoff);
+    return;
+  }
+
+  *connection = handoff->connection;
+  free(handoff);
+  connection->stream.reactor = &server->reactor;
+  tcp_set_buffer_pool(&connection->stream, &server->buffers);
+  connection->server = server;
+  connection->dirty = false;
+  evented_set_handler(&connection->stream.state, server_connection_event, connection);
+  evented_set_stats(&connection->stream.state, &server->stats.connection_ns);
+  timer_init(&connection->idle_timer, server_connection_idle, connection);
+  unsigned events = IO_EVENT_READ;
+  if (tcp_pending(&connection->stream) != 0 || (connection->stream.flags & TCP_EAGER_SEND)) {
+    events |= IO_EVENT_WRITE;
+  }
+
+  if (reactor_register(&server->reactor, &connection->stream.state, events) == -1) {
+    LOG_WARN("[%02d] Failed to register handed over connection: %s", connection_id(connection), strerror(errno));
+    tcp_close(&connection->stream);
+    server_release_connection(server, connection);
+    return;
+  }
+
+  // output corked by the previous owner is flushed by this one
+  if (connection->stream.flags & TCP_CORKED) {
+    server_mark_dirty(server, connection);
+  }
+
+  // process the input which was left by the previous owner
+  if (server_event(server, connection, IO_EVENT_READ) == -1) {
+    server_disconnect(server, connection);
+  }
+}
+
+int server_connect_local(Server* server, TcpStream* client, int (*pair)(TcpStream*, TcpStream*, Reactor*)) {
+  Connection* connection = pool_aquire(&server->connections);
+  if (connection == NULL) {
+    LOG_WARN("Could not connect local client: the connection pool is full");
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  // the pipe may point to the stream, so it's created right in the pool
+  if (pair(&connection->stream, client, &server->reactor) == -1) {
+    LOG_WARN("Failed to create local connection: %s", strerror(errno));
+    pool_release(&server->connections, connection);
+    return -1;
+  }
+
+  memset(&connection->address, 0, sizeof(connection->address));
+  connection->address.sin_family = AF_INET;
+  connection->address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (server_start_connection(server, connection) == -1) {
+    tcp_close(client);
+    pool_release(&server->connections, connection);
+    return -1;
+  }
+
+  LOG_INFO("[%02d] Local client connected over %s transport", connection_id(connection), connection->stream.transport->name);
+  return 0;
+}
+
+// Sides of a lobby: player is the owner, opponent is the guest
+static void restart_write_object(RestartWriter* writer, const GameObject* object) {
+  restart_write(writer, &object->bbox, sizeof(object->bbox));
+  restart_write(writer, &object->speed, sizeof(object->speed));
+}
+
+static void restart_read_object(RestartReader* reader, GameObject* object) {
+  restart_read(reader, &object->bbox, sizeof(object->bbox));
+  restart_read(reader, &object->speed, sizeof(object->speed));
+}
+
+// Write unread input or unsent output of |stream|: size and bytes
+static void restart_write_buffer(RestartWriter* writer, TcpStream* stream, bool input) {
+  struct iovec iov[2];
+  int n = input ? tcp_input_iov(stream, iov) : tcp_output_iov(stream, iov);
+  int32_t size = 0;
+  for (int i = 0; i < n; ++i) {
+    size += iov[i].iov_len;
+  }
+
+  restart_write(writer, &size, sizeof(size));
+  for (int i = 0; i < n; ++i) {
+    restart_write(writer, iov[i].iov_base, iov[i].iov_len);
+  }
+}
+
+// Connections are written as: pool index, socket, address, pending SERVER_UPDATE,
+// pool index of the spectated lobby (-1 if none), input, output
+// Lobbies as: pool index (a part of the lobby id), pool indices of the players, password, game
+void server_dump(Server* server, RestartWriter* writer) {
+  // connections handed over to this worker, but not adopted yet, are adopted first to be part of the dump
+  reactor_run_tasks(&server->reactor);
+  restart_write_fd(writer, server->listener.state.fd);
+
+  // in-process connections can't outlive the process
+  int32_t n_connections = 0;
+  for (Connection* c = pool_first(&server->connections); c != NULL; c = pool_next(&server->connections, c)) {
+    n_connections += c->stream.state.fd != -1;
+  }
+
+  restart_write(writer, &n_connections, sizeof(n_connections));
+  for (Connection* c = pool_first(&server->connections); c != NULL; c = pool_next(&server->connections, c)) {
+    if (c->stream.state.fd == -1) {
+      continue;
     }
-    LOG_INFO("Connection pool is no longer full. Starting to accept new clients.");
+
+    int32_t index = pool_index(&server->connections, c);
+    restart_write(writer, &index, sizeof(index));
+    restart_write_fd(writer, c->stream.state.fd);
+    restart_write(writer, &c->address, sizeof(c->address));
+    // sessions are made anew by the new process, only the update lane and the lobby travel
+    static const Session NO_SESSION;
+    const Session* session = c->session != NULL ? c->session : &NO_SESSION;
+    restart_write(writer, &session->has_update, sizeof(session->has_update));
+    restart_write(writer, &session->update, sizeof(session->update));
+    // a pending frame is dropped, the next tick makes a new one
+    int32_t spectating = session->spectating != NULL ? pool_index(&server->lobbies, session->spectating) : -1;
+    restart_write(writer, &spectating, sizeof(spectating));
+    restart_write_buffer(writer, &c->stream, true);
+    restart_write_buffer(writer, &c->stream, false);
+  }
+
+  int32_t n_lobbies = 0;
+  for (Lobby* lobby = pool_first(&server->lobbies); lobby != NULL; lobby = pool_next(&server->lobbies, lobby)) {
+    n_lobbies += lobby->owner->stream.state.fd != -1;
+  }
+
+  restart_write(writer, &n_lobbies, sizeof(n_lobbies));
+  for (Lobby* lobby = pool_first(&server->lobbies); lobby != NULL; lobby = pool_next(&server->lobbies, lobby)) {
+    if (lobby->owner->stream.state.fd == -1) {
+      continue;
+    }
+
+    int32_t index = pool_index(&server->lobbies, lobby);
+    int32_t owner = pool_index(&server->connections, lobby->owner);
+    int32_t guest = -1;
+    if (lobby->guest != NULL && lobby->guest->stream.state.fd != -1) {
+      guest = pool_index(&server->connections, lobby->guest);
+    }
+
+    int32_t state = lobby->game.state;
+    restart_write(writer, &index, sizeof(index));
+    restart_write(writer, &owner, sizeof(owner));
+    restart_write(writer, &guest, sizeof(guest));
+    restart_write(writer, lobby->password, sizeof(lobby->password));
+    restart_write(writer, &state, sizeof(state));
+    restart_write_object(writer, &lobby->game.player);
+    restart_write_object(writer, &lobby->game.opponent);
+    restart_write_object(writer, &lobby->game.ball);
   }
 }
 
-static const int MAX_EVENTS = 64;
-static const int POLL_INTERVAL_MS = 128;
+void server_detach(Server* server) {
+  for (Connection* c = pool_first(&server->connections); c != NULL; c = pool_next(&server->connections, c)) {
+    reactor_cancel(&server->reactor, &c->idle_timer);
+    // no shutdown(), the new process owns the other reference of the socket
+    tcp_close(&c->stream);
+    server_unmark_dirty(server, c);
+    server_release_session(server, c);
+    pool_release(&server->connections, c);
+  }
 
-int server_run(Server* server) {
-  if (tcp_listener_start_accept(&server->listener) == -1) {
-    LOG_ERROR("Failed to start accept() operatioon: %s", strerror(errno));
+  for (Lobby* lobby = pool_first(&server->lobbies); lobby != NULL; lobby = pool_next(&server->lobbies, lobby)) {
+    pool_release(&server->lobbies, lobby);
+  }
+  server->n_active_lobbies = 0;
+}
+
+// Restore a connection of the old process which follows its pool index, see server_dump()
+// The pool index of the lobby it spectates is stored to |spectating|, the lobby is restored later
+// returns: the connection, NULL if it's dropped
+static Connection* server_restore_connection(Server* server, RestartReader* reader, int32_t* spectating) {
+  int fd = restart_read_fd(reader);
+  struct sockaddr_in address;
+  bool has_update;
+  ServerUpdate update;
+  restart_read(reader, &address, sizeof(address));
+  restart_read(reader, &has_update, sizeof(has_update));
+  restart_read(reader, &update, sizeof(update));
+  restart_read(reader, spectating, sizeof(*spectating));
+  int32_t input_size = 0;
+  restart_read(reader, &input_size, sizeof(input_size));
+  const char* input = restart_read_bytes(reader, input_size);
+  int32_t output_size = 0;
+  restart_read(reader, &output_size, sizeof(output_size));
+  const char* output = restart_read_bytes(reader, output_size);
+  if (reader->failed) {
+    if (fd != -1) {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  Connection* connection = pool_aquire(&server->connections);
+  if (connection == NULL || tcp_from_socket(&connection->stream, &server->reactor, fd) == -1) {
+    LOG_WARN("[%02d] Failed to restore connection: %s", fd, connection == NULL ? "the connection pool is full" : strerror(errno));
+    if (connection != NULL) {
+      pool_release(&server->connections, connection);
+    }
+    close(fd);
+    return NULL;
+  }
+
+  connection->address = address;
+  if (server_start_connection(server, connection) == -1) {
+    pool_release(&server->connections, connection);
+    return NULL;
+  }
+
+  // the output goes out with the first flush, after the output of the old process
+  server_mark_dirty(server, connection);
+  // the connection is a player if it has an update, one it can't keep is replaced by the next tick
+  if (has_update && server_attach_session(server, connection) == 0) {
+    connection->session->update = update;
+    connection->session->has_update = true;
+  }
+  if (tcp_push_input(&connection->stream, input, input_size) == -1 ||
+      tcp_start_send(&connection->stream, output, output_size) == -1) {
+    LOG_WARN("[%02d] Failed to restore buffers of connection: %s", connection_id(connection), strerror(errno));
+    server_disconnect(server, connection);
+    return NULL;
+  }
+
+  // input which is already buffered won't be reported by the socket
+  if (input_size != 0) {
+    reactor_defer(&server->reactor, &connection->stream.state, IO_EVENT_READ);
+  }
+
+  return connection;
+}
+
+int server_init_restored(Server* server, const ServerConfig* config, int id, Server* workers, RestartReader* reader) {
+  if (server_init_worker(server, config, id, workers) == -1) {
     return -1;
   }
 
-  // TODO: wrap timer into something crossplatform and readable
-  struct itimerspec time = {.it_value = {.tv_sec = 1, .tv_nsec = 0},
-                            .it_interval = {.tv_sec = 0, .tv_nsec = 16 * 1000 * 1000}};
+  int listener = restart_read_fd(reader);
+  if (listener == -1 || tcp_listener_from_socket(&server->listener, &server->reactor, listener) == -1) {
+    LOG_ERROR("Failed to restore tcp listener: %s", reader->failed ? "malformed state" : strerror(errno));
+    if (listener != -1) {
+      close(listener);
+    }
+    return -1;
+  }
 
-  if (timerfd_settime(server->timer.fd, 0, &time, NULL) < 0) {
-    LOG_ERROR("Failed to set time for timer: %s", strerror(errno));
+  // connections by their pool index in the old process
+  int capacity = pool_capacity(&server->connections);
+  Connection** restored = calloc(capacity, sizeof(Connection*));
+  // and pool indices of the lobbies they spectate
+  int32_t* spectated = malloc(capacity * sizeof(int32_t));
+  if (restored == NULL || spectated == NULL) {
+    LOG_ERROR("Failed to restore worker #%d: out of memory", id);
+    free(restored);
+    free(spectated);
     return -1;
   }
 
-  if (reactor_register(&server->reactor, &server->timer, IO_EVENT_READ) < 0) {
-    LOG_ERROR("Failed to register the timer: %s", strerror(errno));
+  int32_t n_connections = 0;
+  restart_read(reader, &n_connections, sizeof(n_connections));
+  for (int i = 0; i < n_connections && !reader->failed; ++i) {
+    int32_t index = -1;
+    int32_t spectating = -1;
+    restart_read(reader, &index, sizeof(index));
+    Connection* connection = server_restore_connection(server, reader, &spectating);
+    if (connection != NULL && index >= 0 && index < capacity) {
+      restored[index] = connection;
+      spectated[index] = spectating;
+    }
+  }
+
+  int32_t n_lobbies = 0;
+  restart_read(reader, &n_lobbies, sizeof(n_lobbies));
+  for (int i = 0; i < n_lobbies && !reader->failed; ++i) {
+    int32_t index, owner_index, guest_index, state;
+    char password[MAX_PASSWORD_SIZE];
+    Game game;
+    restart_read(reader, &index, sizeof(index));
+    restart_read(reader, &owner_index, sizeof(owner_index));
+    restart_read(reader, &guest_index, sizeof(guest_index));
+    restart_read(reader, password, sizeof(password));
+    restart_read(reader, &state, sizeof(state));
+    restart_read_object(reader, &game.player);
+    restart_read_object(reader, &game.opponent);
+    restart_read_object(reader, &game.ball);
+    password[MAX_PASSWORD_SIZE - 1] = '\0';
+
+    Connection* owner = owner_index >= 0 && owner_index < capacity ? restored[owner_index] : NULL;
+    Connection* guest = guest_index >= 0 && guest_index < capacity ? restored[guest_index] : NULL;
+    // lobby ids are known to clients, so lobbies keep their slots
+    Lobby* lobby = owner != NULL && owner->lobby == NULL ? pool_aquire_at(&server->lobbies, index) : NULL;
+    if (lobby != NULL && (server_attach_session(server, owner) == -1 ||
+                          (guest != NULL && server_attach_session(server, guest) == -1))) {
+      pool_release(&server->lobbies, lobby);
+      lobby = NULL;
+    }
+
+    if (lobby == NULL) {
+      LOG_WARN("Failed to restore lobby #%d", index * config->workers + id);
+      if (guest != NULL && send_error(guest, OPPONENT_DISCONNECTED) == -1) {
+        server_disconnect(server, guest);
+        restored[guest_index] = NULL;
+      }
+      continue;
+    }
+
+    lobby_init(lobby, owner, password);
+    owner->lobby = lobby;
+    if (guest != NULL) {
+      lobby->guest = guest;
+      guest->lobby = lobby;
+    }
+
+    lobby->game.state = state;
+    lobby->game.player.bbox = game.player.bbox;
+    lobby->game.player.speed = game.player.speed;
+    lobby->game.opponent.bbox = game.opponent.bbox;
+    lobby->game.opponent.speed = game.opponent.speed;
+    lobby->game.ball.bbox = game.ball.bbox;
+    lobby->game.ball.speed = game.ball.speed;
+    if (guest != NULL && lobby->game.state == STATE_RUNNING) {
+      server_activate_lobby(server, lobby);
+    }
+  }
+
+  for (int i = 0; i < capacity && !reader->failed; ++i) {
+    if (restored[i] == NULL || restored[i]->lobby != NULL) {
+      continue;
+    }
+
+    // a player whose lobby is gone
+    if (spectated[i] == -1) {
+      server_release_session(server, restored[i]);
+      continue;
+    }
+
+    Lobby* lobby = spectated[i] >= 0 && spectated[i] < pool_capacity(&server->lobbies)
+                       ? pool_at(&server->lobbies, spectated[i]) : NULL;
+    if (lobby != NULL && pool_contains(&server->lobbies, lobby) && server_attach_session(server, restored[i]) == 0) {
+      lobby_add_spectator(lobby, restored[i]);
+    }
+    else if (send_error(restored[i], OPPONENT_DISCONNECTED) == -1) {
+      server_disconnect(server, restored[i]);
+    }
+  }
+
+  free(restored);
+  free(spectated);
+  if (reader->failed) {
+    LOG_ERROR("Failed to restore worker #%d: malformed state", id);
+    return -1;
+  }
+
+  server->restored = true;
+  if (id == 0) {
+    LOG_INFO("Restored:        %d connections, %d lobbies", pool_size(&server->connections), pool_size(&server->lobbies));
+  }
+  return 0;
+}
+
+// Runs on worker #0 when a new process connects to ServerConfig.restart_socket
+static int server_restart_event(void* context, unsigned events) {
+  (void)events;
+  Server* server = context;
+  // blocking, the transfer happens once the workers are stopped
+  int successor = accept4(server->restart_listener.fd, NULL, NULL, SOCK_CLOEXEC);
+  if (successor == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED) {
+      return 0;
+    }
+
+    LOG_ERROR("Failed to accept restart request: %s", strerror(errno));
     return -1;
   }
 
+  if (server->successor != -1) {
+    close(successor);
+    return 0;
+  }
+
+  // the new process gets every client socket and the passwords of the lobbies
+  uid_t uid;
+  if (unix_peer_uid(successor, &uid) == -1 || uid != geteuid()) {
+    LOG_WARN("Rejected restart request of another user");
+    close(successor);
+    return 0;
+  }
+
+  // the path is free for the restart socket of the new process
+  LOG_INFO("New process is taking over, stopping workers");
+  reactor_deregister(&server->reactor, &server->restart_listener);
+  close(server->restart_listener.fd);
+  unlink(server->config.restart_socket);
+  server->restart_listener.fd = -1;
+  server->successor = successor;
+  for (int i = 0; i < server->config.workers; ++i) {
+    server_stop(&server->workers[i]);
+  }
+
+  return 0;
+}
+
+static int server_timer_event(void* context, unsigned events) {
+  (void)events;
+  Server* server = context;
+
+  uint64_t n_ticks = 0;
+  if (read(server->timer.fd, &n_ticks, sizeof(n_ticks)) != sizeof(n_ticks)) {
+    if (errno == EAGAIN) {
+      return 0;
+    }
+
+    LOG_ERROR("timer internal error: %s", strerror(errno));
+    return -1;
+  }
+
+  // how long the latest tick has been waiting for us
+  server->ticks += n_ticks;
+  uint64_t due = server->tick_start_ns + (server->ticks - 1) * TICK_INTERVAL_MS * 1000 * 1000;
+  uint64_t now = clock_now_ns();
+  uint64_t lateness_ns = now > due ? now - due : 0;
+  TickLatency* latency = &server->tick_latency[server->spinning];
+  latency->ticks++;
+  latency->total_ns += lateness_ns;
+  histogram_add(&server->stats.tick_lateness_ns, lateness_ns);
+
+  server->tick_due = true;
+  return 0;
+}
+
+// Number of ticks the games are behind CLOCK_MONOTONIC at |now|, at most MAX_CATCH_UP_TICKS
+// The schedule is absolute, so late wakes and missed timer expirations don't slow the games down
+static int server_due_ticks(Server* server, uint64_t now) {
+  const uint64_t interval_ns = TICK_INTERVAL_MS * 1000 * 1000;
+  if (now < server->tick_start_ns) {
+    return 0;
+  }
+
+  uint64_t due = (now - server->tick_start_ns) / interval_ns + 1;
+  uint64_t steps = due - server->simulated_ticks;
+  if (steps > MAX_CATCH_UP_TICKS) {
+    server->stats.skipped_ticks += steps - MAX_CATCH_UP_TICKS;
+    server->simulated_ticks += steps - MAX_CATCH_UP_TICKS;
+    steps = MAX_CATCH_UP_TICKS;
+  }
+
+  server->simulated_ticks += steps;
+  histogram_add(&server->stats.tick_steps, steps);
+  // how far the simulated time trails the wall clock once the stage has caught up
+  histogram_add(&server->stats.simulation_lag_ns, now - (server->tick_start_ns + (server->simulated_ticks - 1) * interval_ns));
+  return steps;
+}
+
+static int server_listener_event(void* context, unsigned events) {
+  (void)events;
+  return server_accept(context);
+}
+
+static int server_connection_event(void* context, unsigned events) {
+  Connection* connection = context;
+  if (server_event(connection->server, connection, events) == -1) {
+    server_disconnect(connection->server, connection);
+  }
+
+  return 0;
+}
+
+static const int POLL_INTERVAL_MS = 128;
+
+// Log |histogram| of values in |unit|s (e.g. 1000 to show ns as us)
+static void log_histogram(int id, const char* name, const Histogram* histogram, double unit) {
+  LOG_INFO("Worker #%d %-16s n=%-8llu avg=%-10.1f p50=%-10.1f p99=%-10.1f max=%.1f",
+           id, name, (unsigned long long)histogram->count,
+           histogram_avg(histogram) / unit,
+           histogram_percentile(histogram, 50) / unit,
+           histogram_percentile(histogram, 99) / unit,
+           histogram->max / unit);
+}
+
+static void server_log_stats(Server* server) {
+  const ReactorStats* reactor = &server->reactor.stats;
+  const ServerStats* stats = &server->stats;
+  LOG_INFO("Worker #%d loop stats (times in us): %d connections, %d lobbies (%d running), blocked for %llu ms in total",
+           server->id, pool_size(&server->connections), pool_size(&server->lobbies), server->n_active_lobbies,
+           (unsigned long long)(reactor->wait_ns.sum / (1000 * 1000)));
+  LOG_INFO("Worker #%d committed slots: %d/%d connections, %d/%d lobbies", server->id,
+           pool_committed(&server->connections), pool_capacity(&server->connections),
+           pool_committed(&server->lobbies), pool_capacity(&server->lobbies));
+  log_histogram(server->id, "events/wake", &reactor->events_per_wake, 1);
+  log_histogram(server->id, "wait", &reactor->wait_ns, 1000);
+  LOG_INFO("Worker #%d reactor syscalls: %llu over %llu waits", server->id,
+           (unsigned long long)reactor_syscalls(&server->reactor), (unsigned long long)reactor->wait_ns.count);
+  log_histogram(server->id, "accept", &stats->accept_ns, 1000);
+  log_histogram(server->id, "accept queue", &stats->accept_queue, 1);
+  LOG_INFO("Worker #%d accept queue full: %llu wakes, accept budget exhausted: %llu wakes", server->id,
+           (unsigned long long)stats->accept_queue_full, (unsigned long long)stats->accept_yields);
+  uint64_t overflows = 0;
+  uint64_t drops = 0;
+  // the counters are shared by all workers
+  if (server->id == 0 && tcp_listen_overflows(&overflows, &drops) == 0) {
+    LOG_INFO("Listen overflows: %llu, listen drops: %llu since start (all sockets of the host)",
+             (unsigned long long)(overflows - server->listen_overflows),
+             (unsigned long long)(drops - server->listen_drops));
+  }
+  log_histogram(server->id, "connection", &stats->connection_ns, 1000);
+  log_histogram(server->id, "tick", &stats->tick_ns, 1000);
+  log_histogram(server->id, "simulate", &stats->simulate_ns, 1000);
+  if (server->simulation.n_threads > 0) {
+    LOG_INFO("Worker #%d simulation steals: %llu", server->id,
+             (unsigned long long)atomic_load(&server->simulation.steals));
+  }
+  log_histogram(server->id, "flush", &stats->flush_ns, 1000);
+  LOG_INFO("Worker #%d coalesced updates: %llu, cached I/O blocks: %d", server->id,
+           (unsigned long long)stats->coalesced_updates, server->buffers.n_free);
+  LOG_INFO("Worker #%d spectator frames: %llu encoded, %llu sent", server->id,
+           (unsigned long long)stats->frames_encoded, (unsigned long long)stats->frames_sent);
+  log_histogram(server->id, "tick lateness", &stats->tick_lateness_ns, 1000);
+  log_histogram(server->id, "ticks/stage", &stats->tick_steps, 1);
+  log_histogram(server->id, "simulation lag", &stats->simulation_lag_ns, 1000);
+  LOG_INFO("Worker #%d skipped ticks: %llu", server->id, (unsigned long long)stats->skipped_ticks);
+  log_histogram(server->id, "rtt", &stats->rtt_us, 1);
+  if (server->config.timestamping) {
+    log_histogram(server->id, "input kernel", &stats->input_kernel_ns, 1000);
+    log_histogram(server->id, "input tick wait", &stats->input_tick_ns, 1000);
+    log_histogram(server->id, "output queue", &stats->output_queue_ns, 1000);
+  }
+  LOG_INFO("Worker #%d retransmits: %llu", server->id, (unsigned long long)stats->retransmits);
+
+  for (Lobby* lobby = pool_first(&server->lobbies); lobby != NULL; lobby = pool_next(&server->lobbies, lobby)) {
+    if (lobby->slow) {
+      LOG_INFO("Worker #%d slow lobby #%d", server->id, server_lobby_id(server, lobby));
+    }
+  }
+
+  for (Connection* c = pool_first(&server->connections); c != NULL; c = pool_next(&server->connections, c)) {
+    if (c->session != NULL && c->session->has_info) {
+      const TcpInfo* info = &c->session->info;
+      LOG_INFO("Worker #%d [%02d] rtt=%u us rttvar=%u us retransmits=%u cwnd=%u unacked=%u unsent=%u pending=%d",
+               server->id, connection_id(c), info->rtt_us, info->rttvar_us, info->retransmits,
+               info->cwnd, info->unacked_bytes, info->unsent_bytes, tcp_pending(&c->stream));
+    }
+  }
+}
+// Busy polling never spins for less than ServerConfig.busy_poll_us / MAX_SPIN_SHRINK
+static const int MAX_SPIN_SHRINK = 16;
+
+// Spin on the reactor for the spin window, then block
+// The window grows while spinning catches events and shrinks while it doesn't,
+// so sparse traffic does not burn CPU for nothing
+static int server_dispatch(Server* server) {
+  int budget_us = server->config.busy_poll_us;
+  if (budget_us == 0) {
+    return reactor_dispatch(&server->reactor, POLL_INTERVAL_MS);
+  }
+
+  uint64_t deadline = clock_now_ns() + (uint64_t)server->spin_window_us * 1000;
+  server->spinning = true;
+  do {
+    int n = reactor_dispatch(&server->reactor, 0);
+    if (n != 0) {
+      server->spinning = false;
+      if (n > 0) {
+        server->spin_window_us = server->spin_window_us * 2 < budget_us ? server->spin_window_us * 2 : budget_us;
+      }
+      return n;
+    }
+  } while (clock_now_ns() < deadline && atomic_load(&server->running));
+  server->spinning = false;
+
+  int min_window_us = budget_us / MAX_SPIN_SHRINK > 0 ? budget_us / MAX_SPIN_SHRINK : 1;
+  server->spin_window_us = server->spin_window_us / 2 > min_window_us ? server->spin_window_us / 2 : min_window_us;
+  return reactor_dispatch(&server->reactor, POLL_INTERVAL_MS);
+}
+
+// Uncork every dirty connection, so its output goes out with a single send()
+static void server_flush(Server* server) {
+  // disconnecting a connection could make its opponent dirty, so the list is popped until empty
+  while (server->dirty != NULL) {
+    Connection* connection = server->dirty;
+    server_unmark_dirty(server, connection);
+    server_flush_update(connection);
+    if (tcp_uncork(&connection->stream) == -1) {
+      LOG_WARN("[%02d] Failed to send: %s", connection_id(connection), strerror(errno));
+      server_disconnect(server, connection);
+      continue;
+    }
+
+    // the uncork could have sent the output which held the lanes back
+    if (server_flush_lanes(server, connection) == -1) {
+      LOG_WARN("[%02d] Failed to send: %s", connection_id(connection), strerror(errno));
+      server_disconnect(server, connection);
+      continue;
+    }
+
+    server_track_output(server, connection);
+  }
+}
+
+// Run the loop of a set up |server| until it's stopped
+// returns: -1 on error, 0 otherwise
+static int server_loop(Server* server) {
   atomic_store(&server->running, true);
 
-  IOEvent events[MAX_EVENTS];
+  // Every iteration runs in stages, regardless of the order of events in the batch:
+  //  1. read and handle input of all ready connections (the timer only marks a tick as due)
+  //  2. tick lobbies, so they see the freshest input
+  //  3. flush output produced by the previous stages, one send() per connection
   while (atomic_load(&server->running)) {
-    int n_events = reactor_poll(&server->reactor, events, MAX_EVENTS, POLL_INTERVAL_MS);
-    if (n_events == -1) {
+    if (server_dispatch(server) == -1) {
       if (errno == EAGAIN || errno == EINTR) {
         continue;
       }
 
-      LOG_ERROR("reactor_poll() failed: %s", strerror(errno));
+      LOG_ERROR("reactor_dispatch() failed: %s", strerror(errno));
       return -1;
     }
 
-    for (int i = 0; i < n_events;  ++i) {
-      Evented* object = events[i].object;
-      if (object == &server->timer) {
-        while (true) {
-          uint64_t n_ticks = 0;
+    if (server->tick_due) {
+      server->tick_due = false;
+      uint64_t start = clock_now_ns();
+      int steps = server_due_ticks(server, start);
+      if (steps > 0) {
+        server_process_active_lobbies(server, steps);
+      }
+      server_sample_connections(server);
+      histogram_add(&server->stats.tick_ns, clock_now_ns() - start);
+    }
+
+    if (server->dirty != NULL) {
+      uint64_t start = clock_now_ns();
+      server_flush(server);
+      histogram_add(&server->stats.flush_ns, clock_now_ns() - start);
+    }
 
-          int res = read(server->timer.fd, &n_ticks, sizeof(n_ticks));
+    if (atomic_exchange(&server->stats_requested, false)) {
+      server_log_stats(server);
+    }
+  }
 
-          if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            break;
-          }
+  return 0;
+}
 
-          if (res != sizeof(n_ticks)) {
-            LOG_ERROR("timer internal error: %s", strerror(errno));
-            return -1;
-          }
+// Take restart requests on |server->restart_listener|
+static int server_listen_restart(Server* server) {
+  evented_set_handler(&server->restart_listener, server_restart_event, server);
+  if (reactor_register(&server->reactor, &server->restart_listener, IO_EVENT_READ) == -1) {
+    LOG_ERROR("Failed to register the restart socket: %s", strerror(errno));
+    return -1;
+  }
 
-        }
-        if (server_process_active_lobbies(server) < 0) {
-          return -1;
-        }
-      }
+  return 0;
+}
 
-      else if (object == &server->listener.state) {
-        if (server_accept(server) < 0) {
-          return -1;
-        }
-      }
-      else {
-        Connection* connection = (Connection*)object;
-        if (server_event(server, connection, events[i].events) < 0) {
-          server_disconnect(server, connection);
-        }
-      }
+int server_run(Server* server) {
+  evented_set_handler(&server->listener.state, server_listener_event, server);
+  evented_set_handler(&server->timer, server_timer_event, server);
+  evented_set_stats(&server->listener.state, &server->stats.accept_ns);
+
+  if (tcp_listener_start_accept(&server->listener) == -1) {
+    LOG_ERROR("Failed to start accept() operatioon: %s", strerror(errno));
+    return -1;
+  }
+
+  if (server->restart_listener.fd != -1 && server_listen_restart(server) == -1) {
+    return -1;
+  }
+
+  // TODO: wrap timer into something crossplatform and readable
+  // the first tick is absolute, so the time every tick is due is known
+  // restored lobbies are in the middle of a game, so they miss at most one tick
+  uint64_t delay_ns = server->restored ? TICK_INTERVAL_MS * 1000 * 1000 : 1000 * 1000 * 1000;
+  server->tick_start_ns = clock_now_ns() + delay_ns;
+  struct itimerspec time = {.it_value = {.tv_sec = server->tick_start_ns / (1000 * 1000 * 1000),
+                                         .tv_nsec = server->tick_start_ns % (1000 * 1000 * 1000)},
+                            .it_interval = {.tv_sec = 0, .tv_nsec = TICK_INTERVAL_MS * 1000 * 1000}};
+
+  if (timerfd_settime(server->timer.fd, TFD_TIMER_ABSTIME, &time, NULL) < 0) {
+    LOG_ERROR("Failed to set time for timer: %s", strerror(errno));
+    return -1;
+  }
+
+  if (reactor_register(&server->reactor, &server->timer, IO_EVENT_READ) < 0) {
+    LOG_ERROR("Failed to register the timer: %s", strerror(errno));
+    return -1;
+  }
+
+  return server_loop(server);
+}
+
+int server_resume(Server* server) {
+  // the restart socket was given up to the new process
+  if (server->id == 0 && server->config.restart_socket != NULL) {
+    server->restart_listener.fd = unix_listen(server->config.restart_socket);
+    if (server->restart_listener.fd == -1) {
+      LOG_ERROR("Failed to listen on restart socket %s: %s", server->config.restart_socket, strerror(errno));
+      return -1;
+    }
+
+    if (server_listen_restart(server) == -1) {
+      return -1;
     }
   }
 
-  return 0;
+  // ticks missed meanwhile are skipped as after any stall, see server_due_ticks()
+  return server_loop(server);
 }
 
 void server_stop(Server* server) {
   atomic_store(&server->running, false);
+  reactor_wake(&server->reactor);
+}
+
+void server_request_stats(Server* server) {
+  atomic_store(&server->stats_requested, true);
+  reactor_wake(&server->reactor);
+}
+
+static uint64_t tick_latency_avg_ns(TickLatency* latency) {
+  return latency->ticks > 0 ? latency->total_ns / latency->ticks : 0;
+}
+
+static void log_tick_latency(Server* server) {
+  TickLatency* spinning = &server->tick_latency[true];
+  TickLatency* blocking = &server->tick_latency[false];
+  uint64_t spinning_avg_ns = tick_latency_avg_ns(spinning);
+  uint64_t blocking_avg_ns = tick_latency_avg_ns(blocking);
+
+  // blocking average is what ticks caught while spinning would have cost without busy polling
+  int64_t saved_ns = 0;
+  if (blocking->ticks > 0) {
+    saved_ns = ((int64_t)blocking_avg_ns - (int64_t)spinning_avg_ns) * (int64_t)spinning->ticks;
+  }
+
+  LOG_INFO("Worker #%d tick latency: %llu us spinning (%llu ticks), %llu us blocking (%llu ticks), saved %lld us",
+           server->id,
+           (unsigned long long)(spinning_avg_ns / 1000), (unsigned long long)spinning->ticks,
+           (unsigned long long)(blocking_avg_ns / 1000), (unsigned long long)blocking->ticks,
+           (long long)(saved_ns / 1000));
 }
 
 void server_close(Server* server) {
+  if (server->config.busy_poll_us > 0) {
+    log_tick_latency(server);
+  }
+
+  // connections which were handed over, but not adopted yet, are adopted to be closed with the rest
+  reactor_run_tasks(&server->reactor);
+
   for (Connection* c = pool_first(&server->connections); c != NULL; c = pool_next(&server->connections, c)) {
     server_disconnect(server, c);
   }
 
+  if (server->restart_listener.fd != -1) {
+    close(server->restart_listener.fd);
+    unlink(server->config.restart_socket);
+  }
+
+  close(server->timer.fd);
   tcp_listener_close(&server->listener);
+  buffer_pool_close(&server->buffers);
+  pool_close(&server->connections);
+  pool_close(&server->lobbies);
+  pool_close(&server->sessions);
+  simulation_pool_close(&server->simulation);
+  free(server->active_lobbies);
   reactor_close(&server->reactor);
 }
 
@@ -1,6 +1,7 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <stdalign.h>
 #include <stdatomic.h>
 
 #include <netinet/in.h>
@@ -8,23 +9,151 @@
 #include "net/reactor.h"
 #include "net/tcp_stream.h"
 #include "net/tcp_listener.h"
+#include "net/shared_buffer.h"
 #include "game/protocol.h"
 #include "game/game.h"
 #include "pool.h"
+#include "simulation.h"
 
 
-#define MAX_CONNECTIONS 32
-#define MAX_LOBBIES 16
+// Defaults of ServerConfig.max_connections and ServerConfig.max_lobbies
+#define DEFAULT_MAX_CONNECTIONS 32
+#define DEFAULT_MAX_LOBBIES 16
+
+typedef struct {
+  // ip and port to listen on
+  const char* host;
+  unsigned short port;
+  // Backend of the network reactor
+  ReactorBackend backend;
+  // Number of worker threads, each one with its own reactor and listener
+  int workers;
+  // Disconnect clients which have sent nothing for this long, 0 to disable
+  int idle_timeout_ms;
+  // Spin on the reactor for up to this long before blocking, 0 to disable
+  int busy_poll_us;
+  // How much input of a single connection is handled per loop iteration,
+  // the rest waits for the next one, so a flood can't delay other lobbies
+  int read_budget_bytes;
+  int read_budget_messages;
+  // Stream buffers of a connection grow up to this size, so short stalls don't disconnect players
+  int max_buffer_size;
+  // Collect kernel timestamps to break down the input-to-update latency, costs a syscall per IO
+  bool timestamping;
+  // Length of the accept queue of the listener
+  int accept_backlog;
+  // Connections accepted per wake of the listener, the rest waits for the next loop iteration,
+  // so a reconnect storm doesn't delay lobby ticks
+  int accept_budget;
+  // Capacity of every worker, memory is committed as connections and lobbies come
+  int max_connections;
+  int max_lobbies;
+  // Threads of every worker which step lobbies in parallel with it, 0 to step them on the worker alone
+  int simulation_threads;
+  // Unix socket a new process connects to in order to take over, see restart.h, NULL to disable
+  const char* restart_socket;
+} ServerConfig;
 
 typedef struct Lobby Lobby;
+struct Server;
+struct RestartWriter;
+struct RestartReader;
+
+// How late ticks of the server timer have been handled
+typedef struct {
+  uint64_t ticks;
+  uint64_t total_ns;
+} TickLatency;
 
+// Loop instrumentation of a worker, the reactor itself collects wait statistics
 typedef struct {
+  // Run time of event handlers and loop stages, ns
+  Histogram accept_ns;
+  // Length of the accept queue on every wake of the listener
+  Histogram accept_queue;
+  // Wakes which have found the accept queue full, i.e. the kernel was dropping connections
+  uint64_t accept_queue_full;
+  // Wakes which have run out of ServerConfig.accept_budget
+  uint64_t accept_yields;
+  Histogram connection_ns;
+  Histogram tick_ns;
+  // Stepping the games of a tick, which runs on the simulation threads
+  Histogram simulate_ns;
+  Histogram flush_ns;
+  // SERVER_UPDATEs overwritten by a newer one before being sent
+  uint64_t coalesced_updates;
+  // Snapshots serialized for spectators and their deliveries, every frame is encoded once for all viewers
+  uint64_t frames_encoded;
+  uint64_t frames_sent;
+  // How late ticks of the server timer are handled, ns
+  Histogram tick_lateness_ns;
+  // Fixed timesteps simulated per tick stage (more than 1 is a catch-up), ticks skipped beyond
+  // the catch-up cap, and how far the simulation trails CLOCK_MONOTONIC after the stage, ns
+  Histogram tick_steps;
+  uint64_t skipped_ticks;
+  Histogram simulation_lag_ns;
+  // Kernel view of connections from TCP_INFO samples: smoothed rtt, us, and retransmitted segments
+  Histogram rtt_us;
+  uint64_t retransmits;
+  // Breakdown of the latency of CLIENT_UPDATEs with ServerConfig.timestamping, ns:
+  // from arrival to the kernel till it's read, from the read till the tick which applies it,
+  // from the tick till the SERVER_UPDATE made by it is handed to the device
+  Histogram input_kernel_ns;
+  Histogram input_tick_ns;
+  Histogram output_queue_ns;
+} ServerStats;
+
+// What a connection has only while it plays or watches a game, taken from Server.sessions for the time
+// it's in a lobby, so the connections which are waiting to enter one don't carry it
+typedef struct Session {
+  // Latest-value lane: the freshest SERVER_UPDATE, which is not written to the stream yet
+  // A newer update overwrites it, so a slow client gets the current state instead of a queue of stale ones
+  // Other messages are never dropped, they go to the stream right away and drop the update, which would follow them
+  ServerUpdate update;
+  bool has_update;
+
+  // Lobby which the connection watches as a spectator, NULL if it doesn't
+  // Spectators of a lobby are linked through |spectator_prev| and |spectator_next|
+  Lobby* spectating;
+  struct Connection* spectator_prev;
+  struct Connection* spectator_next;
+  // Latest-value lane of a spectator: the freshest serialized SERVER_UPDATE of the lobby,
+  // shared with the other spectators and sent right from the shared buffer, other messages drop it like |update|
+  SharedBuffer* frame;
+
+  // The latest TCP_INFO sample, taken at least every TCP_INFO_INTERVAL_TICKS
+  TcpInfo info;
+  bool has_info;
+  // Retransmits between the last two samples
+  uint32_t new_retransmits;
+
+  // Latency attribution with ServerConfig.timestamping, CLOCK_MONOTONIC ns, 0 if there is nothing to track:
+  // kernel arrival and read of the first CLIENT_UPDATE which is not ticked yet
+  uint64_t input_rx_ns;
+  uint64_t input_read_ns;
+  // the tick which has applied it and the end of its SERVER_UPDATE in the stream, 0 until it's flushed
+  uint64_t output_tick_ns;
+  uint64_t output_end;
+} Session;
+
+typedef struct Connection {
   // Client IO state
-  // WARNING: must be first
   TcpStream stream;
   // ip and port of the client
   struct sockaddr_in address;
   Lobby* lobby;
+  // Worker which owns this connection
+  struct Server* server;
+  // Fires if client has been silent for ServerConfig.idle_timeout_ms
+  Timer idle_timer;
+  // Neighbours in the list of connections with unflushed output
+  struct Connection* dirty_prev;
+  struct Connection* dirty_next;
+  bool dirty;
+  // Output which the socket had not taken yet when the connection became dirty
+  int backlog;
+  // NULL unless the connection plays in |lobby| or watches one
+  Session* session;
 } Connection;
 
 typedef struct Lobby {
@@ -33,25 +162,106 @@ typedef struct Lobby {
 
   char password[MAX_PASSWORD_SIZE];
   Game game;
+  // One of the players has a high rtt or is losing packets, see server_check_lobby()
+  bool slow;
+
+  // Position in Server.active_lobbies while the game is running, -1 otherwise
+  int active_index;
+
+  // Read-only connections, which see the game as the owner does
+  Connection* spectators;
+  int n_spectators;
+
+  // Snapshots taken by the latest simulation step, for the owner and the guest
+  ServerUpdate owner_update;
+  ServerUpdate guest_update;
 } Lobby;
 
-typedef struct {
+// A single worker of the server, owns a subset of connections and lobbies
+typedef struct Server {
+  ServerConfig config;
+  // Index of this worker in |workers|
+  int id;
+  // All workers of the server (including this one)
+  struct Server* workers;
+
   atomic_bool running;
   Reactor reactor;
   TcpListener listener;
 
   Evented timer;
+  // Set by the timer, lobbies are ticked once the input of the loop iteration is read
+  bool tick_due;
+  // Connections which have output queued during the loop iteration
+  Connection* dirty;
+  // Schedule of |timer|: time of the first tick and number of ticks handled so far
+  uint64_t tick_start_ns;
+  uint64_t ticks;
+  // Fixed timesteps the games have been advanced by (or skipped), ticks due by the clock are caught up
+  uint64_t simulated_ticks;
 
-  char connections_memory[POOL_CAPACITY(Connection, MAX_CONNECTIONS)];
-  Pool connections;
+  // Current spin window of busy polling, adapted to the density of events
+  int spin_window_us;
+  bool spinning;
+  // Indexed by |spinning| at the moment the tick was handled
+  TickLatency tick_latency[2];
+
+  // Slot of the connection pool to sample TCP_INFO of next
+  int sample_cursor;
+  // ListenOverflows and ListenDrops of the network namespace when the worker was started
+  uint64_t listen_overflows;
+  uint64_t listen_drops;
+
+  // Hot restart: listener of ServerConfig.restart_socket (worker #0 only), the connected new process,
+  // and whether this worker has taken over from the old one
+  Evented restart_listener;
+  int successor;
+  bool restored;
+
+  ServerStats stats;
+  // Set by server_request_stats(), the worker logs its stats and resets it
+  atomic_bool stats_requested;
 
-  char lobbies_memory[POOL_CAPACITY(Lobby, MAX_LOBBIES)];
+  // I/O buffers of connections, they hold a block only while they have unread input or unsent output
+  BufferPool buffers;
+
+  Pool connections;
   Pool lobbies;
+  // Sessions of the connections which are in a lobby
+  Pool sessions;
+
+  // Dense set of lobbies with both players and a running game, they are ticked on |simulation|
+  // Lobbies join it when the guest joins or the game restarts and leave it when the game ends or a player leaves
+  Lobby** active_lobbies;
+  int n_active_lobbies;
+  SimulationPool simulation;
 } Server;
 
-int server_init(Server* server, const char* host, unsigned short port);
+// Fill |config| with default values
+void server_config_init(ServerConfig* config);
+
+// Initialize worker #|id| of |workers| (an array of |config->workers| servers)
+int server_init(Server* server, const ServerConfig* config, int id, Server* workers);
 int server_run(Server* server);
 void server_stop(Server* server);
+// Ask the worker to log its loop statistics, async-signal-safe
+void server_request_stats(Server* server);
 void server_close(Server* server);
 
+// Hot restart (see restart.h), the workers must be stopped
+// Write the state of the worker and pass its sockets
+void server_dump(Server* server, struct RestartWriter* writer);
+// Close sockets of the worker once the new process has them, clients stay connected
+void server_detach(Server* server);
+// Run the worker again after a failed handover, its clients stay with this process
+int server_resume(Server* server);
+// Initialize worker #|id| from the next part of the dump, it resumes the lobbies of the old process
+int server_init_restored(Server* server, const ServerConfig* config, int id, Server* workers,
+                         struct RestartReader* reader);
+
+// Connect |client| to the worker without a listener, e.g. to run simulated clients in-process
+// |pair| is tcp_memory_pair or tcp_socketpair, |client| is bound to the reactor of the worker,
+// so it must be driven from the worker thread (or before server_run())
+int server_connect_local(Server* server, TcpStream* client, int (*pair)(TcpStream*, TcpStream*, Reactor*));
+
 #endif // SERVER_H
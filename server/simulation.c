@@ -0,0 +1,215 @@
+#include "simulation.h"
+
+#include <stdlib.h>
+
+
+static uint64_t simulation_range(uint32_t begin, uint32_t end) {
+  return (uint64_t)end << 32 | begin;
+}
+
+// Take the first job of participant #|self|
+// returns: false if its range is empty
+static bool simulation_pop(SimulationPool* pool, int self, int* index) {
+  SimulationRange* range = &pool->ranges[self];
+  uint64_t current = atomic_load(&range->range);
+  for (;;) {
+    uint32_t begin = current;
+    uint32_t end = current >> 32;
+    if (begin >= end) {
+      return false;
+    }
+
+    if (atomic_compare_exchange_weak(&range->range, &current, simulation_range(begin + 1, end))) {
+      *index = begin;
+      return true;
+    }
+  }
+}
+
+// Move the back half of the biggest range of other participants to the empty range of |self|
+// returns: false if there is nothing left to steal
+static bool simulation_steal(SimulationPool* pool, int self) {
+  int n_ranges = pool->n_threads + 1;
+  for (;;) {
+    int victim = -1;
+    uint64_t current = 0;
+    uint32_t most = 0;
+    for (int i = 1; i < n_ranges; ++i) {
+      int candidate = (self + i) % n_ranges;
+      uint64_t range = atomic_load(&pool->ranges[candidate].range);
+      uint32_t begin = range;
+      uint32_t end = range >> 32;
+      if (begin < end && end - begin > most) {
+        victim = candidate;
+        current = range;
+        most = end - begin;
+      }
+    }
+
+    if (victim == -1) {
+      return false;
+    }
+
+    uint32_t begin = current;
+    uint32_t end = current >> 32;
+    uint32_t half = (end - begin + 1) / 2;
+    if (atomic_compare_exchange_strong(&pool->ranges[victim].range, &current, simulation_range(begin, end - half))) {
+      // nobody touches an empty range, so a plain store is enough
+      atomic_store(&pool->ranges[self].range, simulation_range(end - half, end));
+      atomic_fetch_add(&pool->steals, 1);
+      return true;
+    }
+  }
+}
+
+static void simulation_work(SimulationPool* pool, int self) {
+  int index;
+  for (;;) {
+    if (simulation_pop(pool, self, &index)) {
+      pool->job(pool->context, index);
+    }
+    else if (!simulation_steal(pool, self)) {
+      return;
+    }
+  }
+}
+
+typedef struct {
+  SimulationPool* pool;
+  int self;
+} SimulationThread;
+
+static void* simulation_thread(void* argument) {
+  SimulationThread thread = *(SimulationThread*)argument;
+  free(argument);
+
+  SimulationPool* pool = thread.pool;
+  uint64_t batch = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->batch == batch && !pool->stopping) {
+      pthread_cond_wait(&pool->started, &pool->lock);
+    }
+
+    if (pool->stopping) {
+      break;
+    }
+
+    batch = pool->batch;
+    pthread_mutex_unlock(&pool->lock);
+    simulation_work(pool, thread.self);
+    pthread_mutex_lock(&pool->lock);
+
+    if (--pool->busy == 0) {
+      pthread_cond_signal(&pool->finished);
+    }
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+int simulation_pool_init(SimulationPool* pool, int n_threads) {
+  pool->n_threads = 0;
+  pool->threads = NULL;
+  pool->ranges = aligned_alloc(alignof(SimulationRange), (n_threads + 1) * sizeof(SimulationRange));
+  if (pool->ranges == NULL) {
+    return -1;
+  }
+
+  for (int i = 0; i <= n_threads; ++i) {
+    atomic_init(&pool->ranges[i].range, 0);
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->started, NULL);
+  pthread_cond_init(&pool->finished, NULL);
+  pool->batch = 0;
+  pool->busy = 0;
+  pool->stopping = false;
+  pool->job = NULL;
+  pool->context = NULL;
+  atomic_init(&pool->steals, 0);
+
+  if (n_threads <= 0) {
+    return 0;
+  }
+
+  pool->threads = malloc(n_threads * sizeof(pthread_t));
+  if (pool->threads == NULL) {
+    simulation_pool_close(pool);
+    return -1;
+  }
+
+  for (int i = 0; i < n_threads; ++i) {
+    SimulationThread* thread = malloc(sizeof(SimulationThread));
+    if (thread == NULL) {
+      simulation_pool_close(pool);
+      return -1;
+    }
+
+    *thread = (SimulationThread){.pool = pool, .self = i + 1};
+    if (pthread_create(&pool->threads[i], NULL, simulation_thread, thread) != 0) {
+      free(thread);
+      simulation_pool_close(pool);
+      return -1;
+    }
+    pool->n_threads++;
+  }
+
+  return 0;
+}
+
+void simulation_pool_close(SimulationPool* pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->started);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->n_threads; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->finished);
+  pthread_cond_destroy(&pool->started);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->threads);
+  free(pool->ranges);
+  pool->threads = NULL;
+  pool->ranges = NULL;
+  pool->n_threads = 0;
+}
+
+void simulation_pool_run(SimulationPool* pool, int n, SimulationJob job, void* context) {
+  if (pool->n_threads == 0) {
+    for (int i = 0; i < n; ++i) {
+      job(context, i);
+    }
+    return;
+  }
+
+  // even split, stealing evens out jobs of different cost
+  int n_ranges = pool->n_threads + 1;
+  for (int i = 0; i < n_ranges; ++i) {
+    uint32_t begin = (uint64_t)n * i / n_ranges;
+    uint32_t end = (uint64_t)n * (i + 1) / n_ranges;
+    atomic_store(&pool->ranges[i].range, simulation_range(begin, end));
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->context = context;
+  pool->busy = pool->n_threads;
+  pool->batch++;
+  pthread_cond_broadcast(&pool->started);
+  pthread_mutex_unlock(&pool->lock);
+
+  simulation_work(pool, 0);
+
+  // barrier: results of all jobs are visible to the caller once the helpers are done
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busy > 0) {
+    pthread_cond_wait(&pool->finished, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,52 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+// Runs a batch of independent jobs (e.g. stepping lobbies) on helper threads and the calling thread
+// The batch is split evenly, a participant which runs out of jobs steals half of the biggest remaining range
+
+typedef void (*SimulationJob)(void* context, int index);
+
+// Jobs of a participant: begin in the low 32 bits, end in the high ones,
+// the owner takes jobs from the front and thieves cut off the back, both with CAS
+typedef struct {
+  alignas(64) _Atomic uint64_t range;
+} SimulationRange;
+
+typedef struct SimulationPool {
+  // Helper threads, the thread which calls simulation_pool_run() is participant #0
+  int n_threads;
+  pthread_t* threads;
+  // n_threads + 1 ranges
+  SimulationRange* ranges;
+
+  pthread_mutex_t lock;
+  // Signals a new batch to helpers and its end to the caller
+  pthread_cond_t started;
+  pthread_cond_t finished;
+  // Batch number, helpers which are still working on it
+  uint64_t batch;
+  int busy;
+  bool stopping;
+
+  SimulationJob job;
+  void* context;
+
+  // Successful steals since the pool was started
+  atomic_uint_fast64_t steals;
+} SimulationPool;
+
+// Start |n_threads| helper threads, 0 runs every batch on the calling thread
+int simulation_pool_init(SimulationPool* pool, int n_threads);
+void simulation_pool_close(SimulationPool* pool);
+
+// Call |job|(|context|, i) for every i in [0, |n|) and return once all of them are done
+void simulation_pool_run(SimulationPool* pool, int n, SimulationJob job, void* context);
+
+#endif // SIMULATION_H
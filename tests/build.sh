@@ -0,0 +1,20 @@
+#! /usr/bin/bash
+
+# Every test is a single compilation unit, which exits with a non-zero status on failure
+for source in *.c; do
+  clang -o "${source%.c}" "$source"           \
+        -std=c11                              \
+        -O2                                   \
+        -g                                    \
+        -pthread                              \
+        -fsanitize=address,undefined          \
+        -Werror=implicit-function-declaration \
+        -Werror=implicit-int                  \
+        -Werror=int-conversion                \
+        -Werror=return-type                   \
+        -Werror=unused-variable               \
+        -Werror=unused-parameter              \
+        -I..                                  \
+        -I../utils                            \
+        -D_GNU_SOURCE || exit 1
+done
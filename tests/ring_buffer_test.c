@@ -0,0 +1,179 @@
+// RingBuffer against a model: a plain array which keeps the stored bytes from offset 0
+// Random operations are applied to both and every observable result is compared
+//
+// Usage: ./ring_buffer_test [seed] [operations]
+
+#include "net/ring_buffer.c"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MAX_CAPACITY 4096
+
+#define CHECK(condition)                                                                        \
+  do {                                                                                          \
+    if (!(condition)) {                                                                         \
+      fprintf(stderr, "%s:%d: check failed: %s (operation %d)\n", __FILE__, __LINE__, #condition, \
+              operation);                                                                       \
+      exit(1);                                                                                  \
+    }                                                                                           \
+  } while (0)
+
+static int operation;
+
+typedef struct {
+  char data[MAX_CAPACITY];
+  int size;
+} Model;
+
+// Bytes which are written are numbered, so a lost or reordered byte is caught
+static char next_byte(void) {
+  static uint8_t counter;
+  return (char)counter++;
+}
+
+static int random_size(int max) {
+  return max > 0 ? rand() % (max + 1) : 0;
+}
+
+// Compare stored bytes through ring_buffer_data_iov()
+static void check_content(const RingBuffer* buffer, const Model* model) {
+  CHECK(ring_buffer_size(buffer) == model->size);
+  CHECK(ring_buffer_space(buffer) == buffer->capacity - model->size);
+  CHECK(buffer->capacity <= buffer->max_capacity);
+
+  struct iovec iov[2];
+  int n = ring_buffer_data_iov(buffer, iov);
+  CHECK(n >= 0 && n <= 2 && (model->size == 0) == (n == 0));
+  int offset = 0;
+  for (int i = 0; i < n; ++i) {
+    CHECK(iov[i].iov_len > 0);
+    CHECK(memcmp(iov[i].iov_base, model->data + offset, iov[i].iov_len) == 0);
+    offset += iov[i].iov_len;
+  }
+  CHECK(offset == model->size);
+
+  n = ring_buffer_space_iov(buffer, iov);
+  int space = 0;
+  for (int i = 0; i < n; ++i) {
+    space += iov[i].iov_len;
+  }
+  CHECK(space == ring_buffer_space(buffer));
+}
+
+static void write_bytes(RingBuffer* buffer, Model* model) {
+  char data[MAX_CAPACITY];
+  int n = random_size(MAX_CAPACITY / 4);
+  for (int i = 0; i < n; ++i) {
+    data[i] = next_byte();
+  }
+
+  bool fits = model->size + n <= buffer->max_capacity;
+  int status = ring_buffer_write(buffer, data, n);
+  CHECK((status == 0) == fits);
+  if (status == 0) {
+    memcpy(model->data + model->size, data, n);
+    model->size += n;
+  }
+}
+
+// Write through free space directly, the way message serialization does,
+// bytes which don't fit right after the stored data are written with ring_buffer_write() instead
+static void commit_bytes(RingBuffer* buffer, Model* model) {
+  struct iovec iov[2];
+  int contiguous = ring_buffer_space_iov(buffer, iov) > 0 ? (int)iov[0].iov_len : 0;
+  int n = rand() % 2 ? random_size(contiguous) : random_size(MAX_CAPACITY / 4);
+  int capacity = buffer->capacity;
+  int head = buffer->head;
+  char* region = ring_buffer_contiguous_space(buffer, n);
+  CHECK((region != NULL) == (contiguous >= n));
+  // stored data stays where it is
+  CHECK(buffer->capacity == capacity && buffer->head == head);
+
+  char data[MAX_CAPACITY];
+  int written = random_size(n);
+  for (int i = 0; i < written; ++i) {
+    data[i] = next_byte();
+  }
+
+  if (region != NULL) {
+    memcpy(region, data, written);
+    ring_buffer_commit(buffer, written);
+  }
+  else if (ring_buffer_write(buffer, data, written) == -1) {
+    CHECK(model->size + written > buffer->max_capacity);
+    return;
+  }
+
+  memcpy(model->data + model->size, data, written);
+  model->size += written;
+}
+
+static void read_bytes(RingBuffer* buffer, Model* model) {
+  char data[MAX_CAPACITY];
+  int n = random_size(model->size);
+  ring_buffer_read(buffer, data, n);
+  CHECK(memcmp(data, model->data, n) == 0);
+  memmove(model->data, model->data + n, model->size - n);
+  model->size -= n;
+}
+
+static void consume_bytes(RingBuffer* buffer, Model* model) {
+  int n = random_size(model->size);
+  ring_buffer_consume(buffer, n);
+  memmove(model->data, model->data + n, model->size - n);
+  model->size -= n;
+}
+
+static void peek_bytes(RingBuffer* buffer, Model* model) {
+  char scratch[MAX_CAPACITY];
+  int n = random_size(model->size);
+  const char* data = ring_buffer_peek(buffer, n, scratch);
+  CHECK(memcmp(data, model->data, n) == 0);
+}
+
+static void reserve_bytes(RingBuffer* buffer, Model* model) {
+  int n = random_size(MAX_CAPACITY / 2);
+  int status = ring_buffer_reserve(buffer, n);
+  CHECK((status == 0) == (model->size + n <= buffer->max_capacity));
+  CHECK(status == -1 || ring_buffer_space(buffer) >= n);
+}
+
+// Streams give the memory back once a buffer is empty and take a fresh block later
+static void reattach(RingBuffer* buffer, Model* model) {
+  if (model->size != 0) {
+    return;
+  }
+
+  free(ring_buffer_detach(buffer));
+  CHECK(buffer->capacity == 0 && ring_buffer_space(buffer) == 0);
+  ring_buffer_attach(buffer, malloc(64), 64);
+}
+
+int main(int argc, char* argv[]) {
+  unsigned seed = argc > 1 ? (unsigned)atoi(argv[1]) : 1;
+  int operations = argc > 2 ? atoi(argv[2]) : 1000000;
+  srand(seed);
+
+  RingBuffer buffer;
+  Model model = {.size = 0};
+  CHECK(ring_buffer_init(&buffer, 64, MAX_CAPACITY) == 0);
+  for (operation = 0; operation < operations; ++operation) {
+    switch (rand() % 7) {
+      case 0: write_bytes(&buffer, &model); break;
+      case 1: commit_bytes(&buffer, &model); break;
+      case 2: read_bytes(&buffer, &model); break;
+      case 3: consume_bytes(&buffer, &model); break;
+      case 4: peek_bytes(&buffer, &model); break;
+      case 5: reserve_bytes(&buffer, &model); break;
+      case 6: reattach(&buffer, &model); break;
+    }
+    check_content(&buffer, &model);
+  }
+
+  ring_buffer_free(&buffer);
+  printf("%d operations with seed %u: OK\n", operations, seed);
+  return 0;
+}
@@ -0,0 +1,6 @@
+#! /usr/bin/bash
+./build.sh || exit 1
+for source in *.c; do
+  echo "${source%.c}"
+  "./${source%.c}" || exit 1
+done
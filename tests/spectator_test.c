@@ -0,0 +1,254 @@
+// Spectators of a lobby over the in-memory transport, driven on the worker thread like bench/local_clients.c
+// Spectators join before the guest, so they see the whole game: the frame is encoded once per tick for all
+// of them and every spectator gets every frame and the end of the game
+// Then half of the spectators disconnect, the owner restarts the game and the rest watch it to the end
+// The server logs every connection, so stderr is best sent to /dev/null
+//
+// Usage: ./spectator_test [spectators]
+
+#include "utils/log.c"
+#include "game/protocol.c"
+#include "game/vec2.c"
+#include "game/game.c"
+#include "net/buffer_pool.c"
+#include "net/ring_buffer.c"
+#include "net/shared_buffer.c"
+#include "net/tcp_stream.c"
+#include "net/socket_transport.c"
+#include "net/memory_transport.c"
+#include "net/tcp_listener.c"
+#include "net/unix_socket.c"
+#include "net/uring.c"
+#include "net/timer.c"
+#include "net/reactor.c"
+#include "server/pool.c"
+#include "server/simulation.c"
+#include "server/restart.c"
+#include "server/server.c"
+
+#include <stdio.h>
+
+#define CHECK(condition)                                                                     \
+  do {                                                                                       \
+    if (!(condition)) {                                                                      \
+      fprintf(stderr, "%s:%d: check failed: %s (game %d)\n", __FILE__, __LINE__, #condition, \
+              test.games);                                                                   \
+      exit(1);                                                                               \
+    }                                                                                        \
+  } while (0)
+
+// The period of the driver timer, about a server tick
+#define CLIENT_TICK_MS 16
+// A game with paddles standing still ends well before this
+#define TEST_TIMEOUT_MS (60 * 1000)
+
+typedef struct {
+  TcpStream stream;
+  bool joined;
+  bool closed;
+  uint64_t updates;
+  // The state of the latest GAME_STATE_UPDATE, -1 before the first one
+  int state;
+} Client;
+
+// Clients #0 and #1 play, the others watch
+static struct {
+  Server* server;
+  Client* clients;
+  int n;
+  int lobby_id;
+  int spectators_joined;
+  // Games which have ended
+  int games;
+  Timer tick;
+  Timer timeout;
+} test;
+
+static int client_send(Client* client, const ClientMessage* message) {
+  char buffer[MAX_PACKET_SIZE];
+  int size = client_message_write(message, buffer, sizeof(buffer));
+  return tcp_start_send(&client->stream, buffer, size) == size ? 0 : -1;
+}
+
+static int client_handle(Client* client, const ServerMessage* message) {
+  ClientMessage reply;
+  switch (message->id) {
+    case LOBBY_CREATED:
+      test.lobby_id = message->lobby_created.id;
+      reply.id = SPECTATE_LOBBY;
+      reply.spectate_lobby.id = test.lobby_id;
+      strcpy(reply.spectate_lobby.password, "test");
+      for (int i = 2; i < test.n; ++i) {
+        if (client_send(&test.clients[i], &reply) == -1) {
+          return -1;
+        }
+      }
+      return 0;
+
+    case LOBBY_JOINED:
+      client->joined = true;
+      // the owner hears about the guest as well
+      if (client == &test.clients[0] || client == &test.clients[1] || ++test.spectators_joined < test.n - 2) {
+        return 0;
+      }
+
+      reply.id = JOIN_LOBBY;
+      reply.join_lobby.id = test.lobby_id;
+      strcpy(reply.join_lobby.password, "test");
+      return client_send(&test.clients[1], &reply);
+
+    case SERVER_UPDATE:
+      client->updates++;
+      return 0;
+
+    case GAME_STATE_UPDATE:
+      client->state = message->game_state_update.state;
+      return 0;
+
+    default:
+      fprintf(stderr, "Unexpected message %#x\n", message->id);
+      return -1;
+  }
+}
+
+static int client_event(void* context, unsigned events) {
+  Client* client = context;
+  if (events & IO_EVENT_WRITE) {
+    if (tcp_send(&client->stream) == -1) {
+      return -1;
+    }
+  }
+
+  if (!(events & IO_EVENT_READ)) {
+    return 0;
+  }
+
+  if (tcp_recv(&client->stream) != 1) {
+    return -1;
+  }
+
+  char scratch[MAX_PACKET_SIZE];
+  int received = tcp_received(&client->stream);
+  while (received > 0) {
+    int n = received < MAX_PACKET_SIZE ? received : MAX_PACKET_SIZE;
+    ServerMessage message;
+    int size = server_message_read(&message, tcp_peek(&client->stream, n, scratch), n);
+    if (size <= 0) {
+      break;
+    }
+
+    if (client_handle(client, &message) == -1 || tcp_consume(&client->stream, size) == -1) {
+      return -1;
+    }
+    received -= size;
+  }
+
+  if (tcp_input_full(&client->stream)) {
+    reactor_defer(client->stream.reactor, &client->stream.state, IO_EVENT_READ);
+  }
+  return 0;
+}
+
+// Every viewer which is still there has got every frame and the outcome the owner has got
+static void check_game_over(void) {
+  const ServerStats* stats = &test.server->stats;
+  Client* owner = &test.clients[0];
+  CHECK(stats->coalesced_updates == 0);
+  // the owner gets a SERVER_UPDATE per tick of the game, the spectators share a frame
+  CHECK(stats->frames_encoded == owner->updates);
+  CHECK(stats->frames_encoded <= stats->tick_ns.count);
+
+  int watching = 0;
+  for (int i = 2; i < test.n; ++i) {
+    Client* spectator = &test.clients[i];
+    if (!spectator->closed) {
+      CHECK(spectator->joined);
+      CHECK(spectator->updates == stats->frames_encoded);
+      CHECK(spectator->state == owner->state);
+      watching++;
+    }
+  }
+
+  Lobby* lobby = pool_at(&test.server->lobbies, test.lobby_id);
+  CHECK(lobby->n_spectators == watching);
+}
+
+static void test_tick(void* context) {
+  (void)context;
+  Client* owner = &test.clients[0];
+  if (owner->state == STATE_WON || owner->state == STATE_LOST) {
+    check_game_over();
+    if (++test.games == 2) {
+      server_stop(test.server);
+      return;
+    }
+
+    // every other spectator leaves, the frames of the next game go to the rest
+    for (int i = 2; i < test.n; i += 2) {
+      tcp_close(&test.clients[i].stream);
+      test.clients[i].closed = true;
+    }
+
+    ClientMessage restart = {.id = CLIENT_STATE_UPDATE};
+    restart.client_state_update.state = CLIENT_STATE_RESTART;
+    CHECK(client_send(owner, &restart) == 0);
+    owner->state = -1;
+  }
+
+  reactor_schedule(&test.server->reactor, &test.tick, CLIENT_TICK_MS);
+}
+
+static void test_timeout(void* context) {
+  (void)context;
+  CHECK(!"the game has not ended in time");
+}
+
+int main(int argc, char* argv[]) {
+  int n_spectators = argc > 1 ? atoi(argv[1]) : 16;
+  if (n_spectators < 2) {
+    fprintf(stderr, "Usage: %s [spectators, 2 at least]\n", argv[0]);
+    return 1;
+  }
+
+  ServerConfig config;
+  server_config_init(&config);
+  config.port = 0;
+  config.max_connections = n_spectators + 2;
+  config.max_lobbies = 1;
+
+  test.n = n_spectators + 2;
+  test.server = malloc(sizeof(Server));
+  test.clients = calloc(test.n, sizeof(Client));
+  CHECK(test.server != NULL && test.clients != NULL);
+  CHECK(server_init(test.server, &config, 0, test.server) == 0);
+
+  for (int i = 0; i < test.n; ++i) {
+    Client* client = &test.clients[i];
+    client->state = -1;
+    CHECK(server_connect_local(test.server, &client->stream, tcp_memory_pair) == 0);
+    evented_set_handler(&client->stream.state, client_event, client);
+    CHECK(tcp_start_recv(&client->stream) == 0 && tcp_set_eager_send(&client->stream) == 0);
+  }
+
+  ClientMessage create = {.id = CREATE_LOBBY};
+  strcpy(create.create_lobby.password, "test");
+  CHECK(client_send(&test.clients[0], &create) == 0);
+
+  timer_init(&test.tick, test_tick, NULL);
+  timer_init(&test.timeout, test_timeout, NULL);
+  reactor_schedule(&test.server->reactor, &test.tick, CLIENT_TICK_MS);
+  reactor_schedule(&test.server->reactor, &test.timeout, TEST_TIMEOUT_MS);
+  CHECK(server_run(test.server) == 0);
+  CHECK(test.games == 2);
+
+  reactor_cancel(&test.server->reactor, &test.timeout);
+  for (int i = 0; i < test.n; ++i) {
+    if (!test.clients[i].closed) {
+      tcp_close(&test.clients[i].stream);
+    }
+  }
+  server_close(test.server);
+  free(test.clients);
+  free(test.server);
+  return 0;
+}
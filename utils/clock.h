@@ -0,0 +1,19 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Monotonic clock, cheap enough to call on every loop iteration (vDSO)
+
+static inline uint64_t clock_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 * 1000 * 1000 + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t clock_now_ms(void) {
+  return clock_now_ns() / (1000 * 1000);
+}
+
+#endif // CLOCK_H
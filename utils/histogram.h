@@ -0,0 +1,49 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// Bucket 0 counts zeros, bucket B counts values in [2^(B-1), 2^B)
+#define HISTOGRAM_BUCKETS 65
+
+// Log2 histogram, cheap enough to be updated on every event
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+static inline void histogram_add(Histogram* histogram, uint64_t value) {
+  int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+  histogram->buckets[bucket]++;
+  histogram->count++;
+  histogram->sum += value;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+static inline uint64_t histogram_avg(const Histogram* histogram) {
+  return histogram->count > 0 ? histogram->sum / histogram->count : 0;
+}
+
+// returns: upper bound of the bucket which contains |percent|% of values
+static inline uint64_t histogram_percentile(const Histogram* histogram, int percent) {
+  uint64_t rank = (histogram->count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; ++bucket) {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank && seen > 0) {
+      if (bucket == 0) {
+        return 0;
+      }
+      uint64_t bound = bucket == 64 ? UINT64_MAX : ((uint64_t)1 << bucket) - 1;
+      return bound < histogram->max ? bound : histogram->max;
+    }
+  }
+
+  return histogram->max;
+}
+
+#endif // HISTOGRAM_H
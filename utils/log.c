@@ -38,8 +38,8 @@ void game_log(LogLevel log_level, const char* file, int line, const char* format
   }
 
   time_t t = time(NULL);
-  // NOTE: gmtime uses static buffer, let's hope it is thread-local...
-  struct tm utc = *gmtime(&t);
+  struct tm utc;
+  gmtime_r(&t, &utc);
   char log_time[32];
   strftime(log_time, sizeof(log_time), "%T", &utc);
 